@@ -0,0 +1,365 @@
+/* ========================================================================== *
+ * ColorQuantizer                                                             *
+ * Palette reduction of a colour image on a compacted 3-D histogram           *
+ * ========================================================================== */
+
+/* ========================================================================== *
+ *                                  HEADER                                    *
+ * ========================================================================== */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <float.h>
+
+#include "ColorQuantizer.h"
+
+// Bits kept per channel in the 3-D histogram
+#define HISTOGRAM_BITS 5
+#define HISTOGRAM_SIDE (1 << HISTOGRAM_BITS)
+#define HISTOGRAM_CELLS (HISTOGRAM_SIDE*HISTOGRAM_SIDE*HISTOGRAM_SIDE)
+
+/* ========================================================================== *
+ *                                   TYPES                                    *
+ * ========================================================================== */
+
+/* Moments of the pixels falling in a set of histogram cells */
+typedef struct {
+    size_t count;               // Number of pixels
+    double sum[3];              // Sum of each channel
+    double sumSquares;          // Sum of the squared norms of the pixels
+} ColorMoments;
+
+/* Box of histogram cells, bounds being [lower, upper) on each axis */
+typedef struct {
+    size_t lower[3];
+    size_t upper[3];
+    ColorMoments moments;
+    double error;               // Squared error if the box is one colour
+} ColorBox;
+
+/* ========================================================================== *
+ *                                 PROTOTYPES                                 *
+ * ========================================================================== */
+
+/* -------------------------------------------------------------------------- *
+ * Index of the histogram cell of a pixel                                     *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * pixel            A valid pointer to the R, G, B values of the pixel        *
+ * maxValue         The maximum value of a channel                            *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * index            The index of the cell in the histogram                    *
+ * -------------------------------------------------------------------------- */
+static size_t cellIndex(const uint16_t* pixel, uint16_t maxValue);
+
+/* -------------------------------------------------------------------------- *
+ * Create the compacted 3-D histogram of an image                             *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image            The image to treat                                        *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * histogram        A vector of HISTOGRAM_CELLS moments, NULL if any error    *
+ * -------------------------------------------------------------------------- */
+static ColorMoments* createColorHistogram(const PortablePixMap* image);
+
+/* -------------------------------------------------------------------------- *
+ * Add some moments to others                                                 *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * total            A valid pointer to the moments to increase                *
+ * moments          A valid pointer to the moments to add                     *
+ * -------------------------------------------------------------------------- */
+static void addMoments(ColorMoments* total, const ColorMoments* moments);
+
+/* -------------------------------------------------------------------------- *
+ * Squared error made by replacing a set of pixels by their mean              *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * moments          A valid pointer to the moments of the pixels              *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * error            The squared error summed over the three channels          *
+ * -------------------------------------------------------------------------- */
+static double momentsError(const ColorMoments* moments);
+
+/* -------------------------------------------------------------------------- *
+ * Define the moments and the error of a box                                  *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * histogram        The 3-D histogram                                         *
+ * box              A valid pointer to a box whose bounds are defined         *
+ * -------------------------------------------------------------------------- */
+static void defineBox(const ColorMoments* histogram, ColorBox* box);
+
+/* -------------------------------------------------------------------------- *
+ * Split a box in two along the axis and at the position minimizing the sum   *
+ * of the squared errors of both halves                                       *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * histogram        The 3-D histogram                                         *
+ * box              A valid pointer to the box to split, which becomes the    *
+ *                  lower half                                                *
+ * upperBox         A valid pointer where the upper half will be stored       *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If the box was split in two non-empty halves              *
+ * false            If all the pixels of the box fall in a single cell        *
+ * -------------------------------------------------------------------------- */
+static bool splitBox(const ColorMoments* histogram, ColorBox* box,
+                     ColorBox* upperBox);
+
+/* ========================================================================== *
+ *                                  FUNCTIONS                                 *
+ * ========================================================================== */
+
+static size_t cellIndex(const uint16_t* pixel, uint16_t maxValue){
+    size_t index = 0;
+    for(size_t c = 0; c < 3; c++){
+        index = index*HISTOGRAM_SIDE +
+                (uint32_t)pixel[c]*HISTOGRAM_SIDE/((uint32_t)maxValue + 1);
+    }
+    return index;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static ColorMoments* createColorHistogram(const PortablePixMap* image){
+    ColorMoments* histogram = calloc(HISTOGRAM_CELLS, sizeof(ColorMoments));
+    if(!histogram){
+        return NULL;
+    }
+
+    for(size_t i = 0; i < image->height; i++){
+        for(size_t j = 0; j < image->width; j++){
+            const uint16_t* pixel = &image->array[i][3*j];
+            ColorMoments* cell = &histogram[cellIndex(pixel, image->maxValue)];
+            cell->count++;
+            for(size_t c = 0; c < 3; c++){
+                cell->sum[c] += pixel[c];
+                cell->sumSquares += (double)pixel[c]*pixel[c];
+            }
+        }
+    }
+    return histogram;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void addMoments(ColorMoments* total, const ColorMoments* moments){
+    total->count += moments->count;
+    for(size_t c = 0; c < 3; c++){
+        total->sum[c] += moments->sum[c];
+    }
+    total->sumSquares += moments->sumSquares;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static double momentsError(const ColorMoments* moments){
+    if(moments->count == 0){
+        return 0.0;
+    }
+    double squaredSum = 0.0;
+    for(size_t c = 0; c < 3; c++){
+        squaredSum += moments->sum[c]*moments->sum[c];
+    }
+    return moments->sumSquares - squaredSum/moments->count;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void defineBox(const ColorMoments* histogram, ColorBox* box){
+    ColorMoments moments = {0, {0.0, 0.0, 0.0}, 0.0};
+    for(size_t r = box->lower[0]; r < box->upper[0]; r++){
+        for(size_t g = box->lower[1]; g < box->upper[1]; g++){
+            for(size_t b = box->lower[2]; b < box->upper[2]; b++){
+                addMoments(&moments, &histogram[(r*HISTOGRAM_SIDE + g)*
+                                                HISTOGRAM_SIDE + b]);
+            }
+        }
+    }
+    box->moments = moments;
+    box->error = momentsError(&moments);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool splitBox(const ColorMoments* histogram, ColorBox* box,
+                     ColorBox* upperBox){
+    size_t bestAxis = 3, bestCut = 0;
+    double bestError = DBL_MAX;
+
+    for(size_t axis = 0; axis < 3; axis++){
+        if(box->upper[axis] - box->lower[axis] < 2){
+            continue;
+        }
+
+        //Moments of the slices of the box orthogonal to the axis
+        ColorMoments slices[HISTOGRAM_SIDE] = {{0, {0.0, 0.0, 0.0}, 0.0}};
+        size_t cell[3];
+        for(cell[0] = box->lower[0]; cell[0] < box->upper[0]; cell[0]++){
+            for(cell[1] = box->lower[1]; cell[1] < box->upper[1]; cell[1]++){
+                for(cell[2] = box->lower[2]; cell[2] < box->upper[2];
+                    cell[2]++){
+                    addMoments(&slices[cell[axis]],
+                               &histogram[(cell[0]*HISTOGRAM_SIDE + cell[1])*
+                                          HISTOGRAM_SIDE + cell[2]]);
+                }
+            }
+        }
+
+        //The lower half holds the slices [lower, cut)
+        ColorMoments lowerHalf = {0, {0.0, 0.0, 0.0}, 0.0};
+        for(size_t cut = box->lower[axis] + 1; cut < box->upper[axis]; cut++){
+            addMoments(&lowerHalf, &slices[cut-1]);
+            ColorMoments upperHalf = box->moments;
+            upperHalf.count -= lowerHalf.count;
+            for(size_t c = 0; c < 3; c++){
+                upperHalf.sum[c] -= lowerHalf.sum[c];
+            }
+            upperHalf.sumSquares -= lowerHalf.sumSquares;
+            if(lowerHalf.count == 0 || upperHalf.count == 0){
+                continue;
+            }
+
+            double error = momentsError(&lowerHalf) + momentsError(&upperHalf);
+            if(error < bestError){
+                bestError = error;
+                bestAxis = axis;
+                bestCut = cut;
+            }
+        }
+    }
+
+    if(bestAxis == 3){
+        return false;
+    }
+
+    *upperBox = *box;
+    box->upper[bestAxis] = bestCut;
+    upperBox->lower[bestAxis] = bestCut;
+    defineBox(histogram, box);
+    defineBox(histogram, upperBox);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+PortablePixMap* quantizeColorImage(const PortablePixMap* image,
+                                   size_t numColors){
+    if(!image || numColors == 0){
+        return NULL;
+    }
+
+    PortablePixMap* res = createEmptyPixMap(image->width, image->height,
+                                            image->maxValue);
+    if(!res){
+        return NULL;
+    }
+    res->type = image->type;
+
+    ColorMoments* histogram = createColorHistogram(image);
+    if(!histogram){
+        deletePixMap(res);
+        return NULL;
+    }
+
+    //A box holds at least one cell, so the palette cannot be larger
+    if(numColors > HISTOGRAM_CELLS){
+        numColors = HISTOGRAM_CELLS;
+    }
+    ColorBox* boxes = malloc(numColors*sizeof(ColorBox));
+    uint16_t* grid = malloc(HISTOGRAM_CELLS*sizeof(uint16_t));
+    if(!boxes || !grid){
+        deletePixMap(res);
+        free(histogram);
+        free(boxes);
+        free(grid);
+        return NULL;
+    }
+
+    //Repeatedly split the box whose error is the largest, the boxes that
+    //cannot be split being given a null error
+    size_t nBoxes = 1;
+    for(size_t c = 0; c < 3; c++){
+        boxes[0].lower[c] = 0;
+        boxes[0].upper[c] = HISTOGRAM_SIDE;
+    }
+    defineBox(histogram, &boxes[0]);
+
+    while(nBoxes < numColors){
+        size_t largest = nBoxes;
+        for(size_t b = 0; b < nBoxes; b++){
+            if(boxes[b].error > 0.0 &&
+               (largest == nBoxes || boxes[b].error > boxes[largest].error)){
+                largest = b;
+            }
+        }
+        if(largest == nBoxes){
+            break;
+        }
+        if(splitBox(histogram, &boxes[largest], &boxes[nBoxes])){
+            nBoxes++;
+        }else{
+            boxes[largest].error = 0.0;
+        }
+    }
+
+    //The palette is made of the means of the boxes
+    uint16_t (*palette)[3] = malloc(nBoxes*sizeof(uint16_t[3]));
+    if(!palette){
+        deletePixMap(res);
+        free(histogram);
+        free(boxes);
+        free(grid);
+        return NULL;
+    }
+    for(size_t b = 0; b < nBoxes; b++){
+        for(size_t c = 0; c < 3; c++){
+            palette[b][c] = boxes[b].moments.count == 0 ? 0 :
+                (uint16_t)(boxes[b].moments.sum[c]/boxes[b].moments.count +
+                           0.5);
+        }
+    }
+
+    //Nearest palette colour of the mean of each non-empty cell
+    for(size_t n = 0; n < HISTOGRAM_CELLS; n++){
+        grid[n] = 0;
+        if(histogram[n].count == 0){
+            continue;
+        }
+        double distanceMin = DBL_MAX;
+        for(size_t b = 0; b < nBoxes; b++){
+            double distance = 0.0;
+            for(size_t c = 0; c < 3; c++){
+                double delta = histogram[n].sum[c]/histogram[n].count -
+                               palette[b][c];
+                distance += delta*delta;
+            }
+            if(distance < distanceMin){
+                distanceMin = distance;
+                grid[n] = (uint16_t)b;
+            }
+        }
+    }
+
+    //Image compression, in O(1) per pixel
+    for(size_t i = 0; i < res->height; i++){
+        for(size_t j = 0; j < res->width; j++){
+            const uint16_t* pixel = &image->array[i][3*j];
+            const uint16_t* color =
+                palette[grid[cellIndex(pixel, image->maxValue)]];
+            for(size_t c = 0; c < 3; c++){
+                res->array[i][3*j + c] = color[c];
+            }
+        }
+    }
+
+    free(palette);
+    free(grid);
+    free(boxes);
+    free(histogram);
+
+    return res;
+}
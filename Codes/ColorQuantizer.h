@@ -0,0 +1,39 @@
+/***********************************************************************
+ * ColorQuantizer
+ * Interface related to the quantization of a colour image.
+ ***********************************************************************/
+
+#ifndef _COLOR_QUANTIZER_H_
+#define _COLOR_QUANTIZER_H_
+
+#include "PortablePixMap.h"
+
+
+/***********************************************************************
+ * Quantize a colour image I in a palette of k colours such that the
+ * quantized image I* (tries to) minimize(s) the squared error summed
+ * over the three channels
+ * \sum_{c = R,G,B} \sum_{i = 1}^height \sum_{j = 1}^width
+ *                                              (I[i,j,c] - I*[i,j,c])^2
+ *
+ * The palette is computed on a compacted 3-D histogram (a few bits per
+ * channel) whose boxes are recursively split where the squared error
+ * decreases the most. Pixels are then remapped through a precomputed
+ * grid giving the nearest palette colour of each histogram cell.
+ *
+ * This function does not affect the original image.
+ *
+ * PARAMETERS
+ * image            - The image to quantize
+ * numColors        - The number of colours of the palette (k > 0), at
+ *                    most the number of cells of the histogram
+ *
+ * RETURN
+ * NULL             - if any error
+ * image            - The quantized image with at most k colours
+ ***********************************************************************/
+PortablePixMap* quantizeColorImage(const PortablePixMap* image,
+                                   size_t numColors);
+
+
+#endif // !_COLOR_QUANTIZER_H_
@@ -7,281 +7,1013 @@
  *                                  HEADER                                    *
  * ========================================================================== */
 #include <stdlib.h>
-#include <limits.h>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
-#include <stdio.h>
-#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
 
 
 #include "Reduction.h"
+#include "ReductionSettings.h"
+#include "ReductionMoments.h"
+
+// Histograms up to this length go through the fixed-size (8-bit) solver
+#define SMALL_HISTOGRAM_LENGTH 256
+
+// Cells of a layer are dealt to the threads by chunks of this size
+#define CHUNK_LENGTH 256
+
+// Minimal number of cells of a layer per thread
+#define CELLS_PER_THREAD 2048
+
+/*
+ * The minimum over m of a cell is evaluated on SIMD lanes with the vector
+ * extensions of GCC and Clang when AVX2 is enabled (-mavx2 or -march=native);
+ * without it, 64-bit lanes are slower than the scalar code.
+ */
+#if defined(__AVX2__) && (defined(__clang__) || __GNUC__ >= 9)
+#define VECTORISED_DP
+#define LANES 4
+typedef uint64_t UnsignedLanes __attribute__((vector_size(LANES*8)));
+typedef int64_t SignedLanes __attribute__((vector_size(LANES*8)));
+typedef double DoubleLanes __attribute__((vector_size(LANES*8)));
+
+// Moments below which the lanes estimate the means exactly enough
+#define VECTOR_MOMENT_LIMIT (UINT64_C(1) << 52)
+#endif
+
+/* ========================================================================== *
+ *                                   TYPES                                    *
+ * ========================================================================== */
+
+/* Data shared by the threads evaluating the layers of the DP */
+typedef struct {
+    const uint64_t* count;      // Prefix moments of the histogram
+    const uint64_t* sum;
+    const uint64_t* squares;
+    size_t length;              // Number of bins of the histogram
+    size_t nLevels;             // Number of layers to evaluate
+    ErrorMetric metric;         // Error of the intervals
+    int64_t* errors;            // Two layers of errors, of size length+1
+    uint32_t* splits;           // Best splits, of size nLevels*(length+1)
+    size_t nWorkers;            // Number of threads sharing the layers
+    pthread_barrier_t barrier;  // Synchronisation between two layers
+
+    bool started;               // Whether nWorkers and barrier are ready
+    pthread_mutex_t mutex;
+    pthread_cond_t startCond;
+} LayerContext;
+
+/* A thread evaluating a part of the layers */
+typedef struct {
+    LayerContext* context;
+    size_t id;                  // Index of the thread (< nWorkers)
+} LayerWorker;
 
 /* ========================================================================== *
  *                                 PROTOTYPES                                 *
  * ========================================================================== */
 
 /* -------------------------------------------------------------------------- *
- * Define the minimal of to given values                                      *
+ * Define a cell of a layer of the dynamic programming, that is the error of  *
+ * the best reduction of the gray levels [0, i) in k levels                   *
+ * E[k][i] = min_{k-1 <= m < i} E[k-1][m] + defineMinError(m, i)              *
+ * the smallest m reaching this minimum being the split of the cell           *
  *                                                                            *
  * PARAMETERS                                                                 *
- * a                The first value to treat                                  *
- * b                The second value to treat                                 *
+ * count, sum, squares  The prefix moments of the histogram                   *
+ * previous         The errors of the layer k-1                               *
+ * mBegin           The smallest split allowed (k-1)                          *
+ * i                The cell to define                                        *
+ * split            A valid pointer where the split will be stored            *
  *                                                                            *
- * RETURN                                                                     *
- * a                If a is the smallest value                                *
- * b                Else                                                      *
+ * RETURNS                                                                    *
+ * errorMin         The error of the cell                                     *
+ * -------------------------------------------------------------------------- */
+static inline int64_t defineCell(const uint64_t* count, const uint64_t* sum,
+                                 const uint64_t* squares,
+                                 const int64_t* previous, size_t mBegin,
+                                 size_t i, uint32_t* split);
+
+#ifdef VECTORISED_DP
+/* -------------------------------------------------------------------------- *
+ * Same as defineCell on SIMD lanes. The means of the intervals are estimated *
+ * in double precision, so that the moments must stay below                   *
+ * VECTOR_MOMENT_LIMIT.                                                       *
+ * -------------------------------------------------------------------------- */
+static inline int64_t defineVectorCell(const uint64_t* count,
+                                       const uint64_t* sum,
+                                       const uint64_t* squares,
+                                       const int64_t* previous,
+                                       size_t mBegin, size_t i,
+                                       uint32_t* split);
+#endif
+
+/* -------------------------------------------------------------------------- *
+ * Same as defineCell for the absolute error. The median of [m, i) only moves *
+ * up as m grows, so that it is followed in O(1) amortized per split.         *
  * -------------------------------------------------------------------------- */
-static long defineMinimum(long a, long b);
+static inline int64_t defineAbsoluteCell(const uint64_t* count,
+                                         const uint64_t* sum,
+                                         const uint64_t* squares,
+                                         const int64_t* previous,
+                                         size_t mBegin, size_t i,
+                                         uint32_t* split);
 
 /* -------------------------------------------------------------------------- *
- * Defined the minimal error made by the replacements of the gray levels in a *
- * given sub-histogram                                                        *
+ * Define the layers of the dynamic programming, the cells of each layer      *
+ * being dealt by chunks to the workers. These functions are generated for a  *
+ * fixed and for a variable histogram length, and for each error metric, so   *
+ * that the interval errors are inlined in the loops.                         *
  *                                                                            *
- * PARAMETRES                                                                 *
- * histogram        A valid pointer to the image's histogram                  *
- * i                The beginning of the sub-histogram                        *
- * j                The end of the sub-histogram to treat                     *
- * level            A valid pointer to a value who will contain the index of  *
- *                  the minimal gray level                                    *
+ * PARAMETERS                                                                 *
+ * context          A valid pointer to the data of the dynamic programming    *
+ * id               The index of the worker                                   *
+ * -------------------------------------------------------------------------- */
+static void defineLayersSmall(LayerContext* context, size_t id);
+static void defineLayersLarge(LayerContext* context, size_t id);
+static void defineLayersSmallAbsolute(LayerContext* context, size_t id);
+static void defineLayersLargeAbsolute(LayerContext* context, size_t id);
+#ifdef VECTORISED_DP
+static void defineLayersSmallScalar(LayerContext* context, size_t id);
+static void defineLayersLargeScalar(LayerContext* context, size_t id);
+#endif
+
+/* -------------------------------------------------------------------------- *
+ * Define the part of the layers of a worker with the generated function      *
+ * fitting the histogram length and the error metric                          *
  *                                                                            *
- * RETURNS                                                                    *
- * errorMin         The minimal error commited                                *
+ * PARAMETERS                                                                 *
+ * context          A valid pointer to the data of the dynamic programming    *
+ * id               The index of the worker                                   *
  * -------------------------------------------------------------------------- */
-static long defineMinError(const size_t* histogram, size_t i, size_t j,
-                           size_t* level);
+static void runLayers(LayerContext* context, size_t id);
 
 /* -------------------------------------------------------------------------- *
- * Create a a three-dimensional array who retain the new level of grey in fun-*
- * ction of the histogram length, the number of level after the reduction and *
- * the value of grey level in the initial image to compress                   *
+ * Body of a thread evaluating the layers of a large histogram                *
  *                                                                            *
  * PARAMETERS                                                                 *
- * nLevels          The number of levels after the image computation          *
- * histogramLength  The length of histogram of the image to treat             *
+ * arg              A valid pointer to a LayerWorker                          *
  *                                                                            *
  * RETURNS                                                                    *
- * newGreyLevel     three-dimensional array as described above                *
+ * NULL             Always                                                    *
  * -------------------------------------------------------------------------- */
-static size_t*** createNewGreyLevel(size_t nLevels, size_t histogramLength);
+static void* runLayerWorker(void* arg);
 
 /* -------------------------------------------------------------------------- *
- * Create a a two-dimensional array who retain the error made by replacing a  *
- * gray level                                                                 *
+ * Define the layers of a large histogram on several threads                  *
  *                                                                            *
  * PARAMETERS                                                                 *
- * nLevels          The number of levels after the image computation          *
- * histogramLength  The length of histogram of the image to treat             *
+ * context          A valid pointer to the data of the dynamic programming,   *
+ *                  whose nWorkers is the number of threads wished            *
+ * -------------------------------------------------------------------------- */
+static void defineLayersParallel(LayerContext* context);
+
+/* -------------------------------------------------------------------------- *
+ * Define the layers of the dynamic programming with the solver fitting the   *
+ * histogram length: fixed-size if length is SMALL_HISTOGRAM_LENGTH, shared   *
+ * among the cores if it is large enough                                      *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * context          A valid pointer to the data of the dynamic programming    *
+ * -------------------------------------------------------------------------- */
+static void defineLayers(LayerContext* context);
+
+/* -------------------------------------------------------------------------- *
+ * Use the splits of the dynamic programming to fill thresholds and levels    *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * metric           The error metric of the dynamic programming               *
+ * count, sum, squares  The prefix moments of the histogram                   *
+ * splits           The splits defined by the dynamic programming             *
+ * length           The number of bins used by the dynamic programming        *
+ * nLevels          The number of levels of the dynamic programming           *
+ * thresholds       An allocated vector of size nLevels                       *
+ * levels           An allocated vector of size nLevels                       *
  *                                                                            *
  * RETURNS                                                                    *
- * errorArray     two-dimensional array as described above                    *
+ * error            The error of the reduction                                *
  * -------------------------------------------------------------------------- */
-static long** createErrorArray(size_t nLevels, size_t histogramLength);
+static uint64_t defineReduction(ErrorMetric metric, const uint64_t* count,
+                                const uint64_t* sum, const uint64_t* squares,
+                                const uint32_t* splits, size_t length,
+                                size_t nLevels, size_t* thresholds,
+                                uint16_t* levels);
 
 /* -------------------------------------------------------------------------- *
- * Define all values contained in newGreyLevel (define above)                 *
+ * Keep each gray level present in the histogram as a level of its own, if    *
+ * there are at most nLevels of them: the error is then zero, and the         *
+ * dynamic programming, whose splits take nLevels*(n+1) entries, is skipped   *
  *                                                                            *
  * PARAMETERS                                                                 *
- * newGreyLevel     A valid pointer to a three-dimensional array              *
  * histogram        The histogram of the image to treat                       *
- * histogramLength  The length of histogram of the image to treat             *
- * nLevels          The number of levels after the image computation          *
- * errMin           A valid pointer to a two-dimensional array                *
+ * histogramLength  The length of the histogram (n)                           *
+ * nLevels          The number of levels asked                                *
+ * thresholds       A vector of size nLevels                                  *
+ * levels           A vector of size nLevels                                  *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * nPresent         The number of levels defined, the gray levels present     *
+ *                  (0 if there are more than nLevels of them, or none)       *
+ * -------------------------------------------------------------------------- */
+static size_t defineIdentity(const size_t* histogram, size_t histogramLength,
+                             size_t nLevels, size_t* thresholds,
+                             uint16_t* levels);
+
+/* -------------------------------------------------------------------------- *
+ * Bring the thresholds and levels back into the real histogram, and repeat   *
+ * the last one if there are fewer levels than asked                          *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * histogramLength  The real length of the histogram                          *
+ * nSolved          The number of levels defined                              *
+ * nLevels          The number of levels asked (>= nSolved)                   *
+ * thresholds       A vector of size nLevels                                  *
+ * levels           A vector of size nLevels                                  *
+ * -------------------------------------------------------------------------- */
+static void completeReduction(size_t histogramLength, size_t nSolved,
+                              size_t nLevels, size_t* thresholds,
+                              uint16_t* levels);
+
+/* -------------------------------------------------------------------------- *
+ * Approximate the reduction by solving the dynamic programming on merged     *
+ * bins, then refining each threshold in a window at full resolution          *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * count, sum, squares  The prefix moments of the histogram                   *
+ * length           The number of bins of the histogram                       *
+ * nLevels          The number of levels (<= length/mergeFactor)              *
+ * mergeFactor      The number of bins merged by the coarse pass (> 1)        *
+ * window           The half-width of the refinement windows                  *
+ * thresholds       An allocated vector of size nLevels                       *
+ * levels           An allocated vector of size nLevels                       *
+ * report           A valid pointer where the error and a bound on the gap to *
+ *                  the optimal error will be stored                          *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If the reduction went fine                                *
+ * false            Else                                                      *
+ * -------------------------------------------------------------------------- */
+static bool defineCoarseToFine(const uint64_t* count, const uint64_t* sum,
+                               const uint64_t* squares, size_t length,
+                               size_t nLevels, size_t mergeFactor,
+                               size_t window, size_t* thresholds,
+                               uint16_t* levels, ReductionReport* report);
+
+/* -------------------------------------------------------------------------- *
+ * Find the best reduction whose thresholds p_1, ..., p_{k-1} are each in a   *
+ * window around given thresholds, p_k being the histogram length             *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * count, sum, squares  The prefix moments of the histogram                   *
+ * length           The number of bins of the histogram                       *
+ * nLevels          The number of levels                                      *
+ * window           The half-width of the windows                             *
+ * thresholds       The centres of the windows, replaced by the thresholds    *
+ *                  found                                                     *
+ * levels           An allocated vector of size nLevels                       *
+ * error            A valid pointer where the error will be stored            *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If the refinement went fine                               *
+ * false            Else                                                      *
+ * -------------------------------------------------------------------------- */
+static bool refineThresholds(const uint64_t* count, const uint64_t* sum,
+                             const uint64_t* squares, size_t length,
+                             size_t nLevels, size_t window,
+                             size_t* thresholds, uint16_t* levels,
+                             uint64_t* error);
+
+/* -------------------------------------------------------------------------- *
+ * Lower bound on the optimal error, given prefix moments sampled at the      *
+ * boundaries of merged bins. An interval costs at least as much as the       *
+ * merged bins it fully contains, and at most k-1 merged bins hold a          *
+ * threshold: the bound is the best reduction of the merged bins where up to  *
+ * one bin may be left out between two consecutive levels.                    *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * count, sum, squares  The sampled prefix moments                            *
+ * length           The number of merged bins                                 *
+ * nLevels          The number of levels                                      *
+ * bound            A valid pointer where the bound will be stored            *
  *                                                                            *
  * RETURNS                                                                    *
- * true             If the definition went fine                               *
+ * true             If the computation went fine                              *
  * false            Else                                                      *
  * -------------------------------------------------------------------------- */
-static bool defineNewGreyLevel(size_t*** newGreyLevel, const size_t* histogram,
-                               size_t histogramLength, size_t nLevels, long** eerrorArray);
+static bool defineLowerBound(const uint64_t* count, const uint64_t* sum,
+                             const uint64_t* squares, size_t length,
+                             size_t nLevels, uint64_t* bound);
 
 
 /* ========================================================================== *
  *                                  FUNCTIONS                                 *
  * ========================================================================== */
 
-long defineMinimum(long a, long b){
-    if(a < b){
-        return a;
-    }else{
-        return b;
+static inline int64_t defineCell(const uint64_t* count, const uint64_t* sum,
+                                 const uint64_t* squares,
+                                 const int64_t* previous, size_t mBegin,
+                                 size_t i, uint32_t* split){
+    int64_t errorMin = INT64_MAX;
+    size_t mMin = mBegin;
+    for(size_t m = mBegin; m < i; m++){
+        int64_t error = previous[m] +
+                        defineMinError(count, sum, squares, m, i, NULL);
+        if(error < errorMin){
+            errorMin = error;
+            mMin = m;
+        }
     }
+    *split = (uint32_t)mMin;
+    return errorMin;
 }
 
+
 /* -------------------------------------------------------------------------- */
 
-size_t*** createNewGreyLevel(size_t nLevels, size_t histogramLength){
-    assert(nLevels > 0 || histogramLength > 0);
-    
-    size_t*** newGreyLevel = malloc((nLevels)*(sizeof(size_t **)));
-    if(!newGreyLevel){
-        return NULL;
-    }
-    
-    for(size_t i = 0; i < nLevels; i++){
-        newGreyLevel[i] = malloc((histogramLength)*(sizeof(size_t *)));
-        if(!newGreyLevel[i]){
-            return NULL;
+#ifdef VECTORISED_DP
+
+static inline int64_t defineVectorCell(const uint64_t* count,
+                                       const uint64_t* sum,
+                                       const uint64_t* squares,
+                                       const int64_t* previous,
+                                       size_t mBegin, size_t i,
+                                       uint32_t* split){
+    const uint64_t ci = count[i], si = sum[i], qi = squares[i];
+
+    /*
+     * Each lane keeps its smallest m reaching its minimum, as m grows. The
+     * level v = round(s/c) is estimated in double precision, the conversions
+     * being done by adding 2^52 (exact as s, c < 2^52), then corrected with
+     * exact integer arithmetic; t = v*c.
+     */
+    const UnsignedLanes exponent = {0x4330000000000000, 0x4330000000000000,
+                                    0x4330000000000000, 0x4330000000000000};
+    SignedLanes errorMin = {INT64_MAX, INT64_MAX, INT64_MAX, INT64_MAX};
+    SignedLanes mMin = {0, 0, 0, 0};
+    SignedLanes mLanes = {0, 1, 2, 3};
+    size_t m = mBegin;
+    for(; m + LANES <= i; m += LANES){
+        UnsignedLanes cm, sm, qm;
+        SignedLanes prev;
+        memcpy(&cm, &count[m], sizeof(cm));
+        memcpy(&sm, &sum[m], sizeof(sm));
+        memcpy(&qm, &squares[m], sizeof(qm));
+        memcpy(&prev, &previous[m], sizeof(prev));
+
+        UnsignedLanes c = ci - cm;
+        UnsignedLanes s = si - sm;
+        UnsignedLanes q = qi - qm;
+
+        //Empty intervals (c = 0, hence s = q = 0) are divided by 1
+        UnsignedLanes divisor = c - (UnsignedLanes)(c == 0);
+        DoubleLanes mean = ((DoubleLanes)(s | exponent) - 0x1p52) /
+                           ((DoubleLanes)(divisor | exponent) - 0x1p52);
+        UnsignedLanes v = (UnsignedLanes)(mean + 0x1p52) ^ exponent;
+        UnsignedLanes t = v*c;
+        UnsignedLanes above = (UnsignedLanes)(t > s);
+        v += above;
+        t -= above & c;
+        UnsignedLanes below = (UnsignedLanes)(2*s > 2*t + c);
+        v -= below;
+        t += below & c;
+
+        SignedLanes error = prev + (SignedLanes)(q - v*(2*s - t));
+        SignedLanes better = error < errorMin;
+        SignedLanes mCurrent = mLanes + (int64_t)m;
+        errorMin = (better & error) | (~better & errorMin);
+        mMin = (better & mCurrent) | (~better & mMin);
+    }
+
+    //Reduction of the lanes, ties going to the smallest m
+    int64_t best = INT64_MAX;
+    size_t bestM = mBegin;
+    for(size_t l = 0; l < LANES; l++){
+        if(errorMin[l] < best ||
+           (errorMin[l] == best && (size_t)mMin[l] < bestM)){
+            best = errorMin[l];
+            bestM = (size_t)mMin[l];
         }
-        for(size_t j = 0; j < histogramLength; j++){
-            newGreyLevel[i][j] = malloc(histogramLength*(sizeof(size_t)));
+    }
+
+    //Remaining splits, all larger than the ones of the lanes
+    for(; m < i; m++){
+        int64_t error = previous[m] +
+                        defineMinError(count, sum, squares, m, i, NULL);
+        if(error < best){
+            best = error;
+            bestM = m;
         }
     }
-    return newGreyLevel;
+
+    *split = (uint32_t)bestM;
+    return best;
 }
 
+#endif
+
 /* -------------------------------------------------------------------------- */
 
-long** createErrorArray(size_t nLevels, size_t histogramLength){
-    assert(nLevels > 0 || histogramLength > 0);
-    
-    long** errorArray = malloc(nLevels*(sizeof(long*)));
-    if(!errorArray){
-        return NULL;
+static inline int64_t defineAbsoluteCell(const uint64_t* count,
+                                         const uint64_t* sum,
+                                         const uint64_t* squares,
+                                         const int64_t* previous,
+                                         size_t mBegin, size_t i,
+                                         uint32_t* split){
+    (void)squares;
+    int64_t errorMin = INT64_MAX;
+    size_t mMin = mBegin;
+    size_t median = mBegin;
+    for(size_t m = mBegin; m < i; m++){
+        const uint64_t c = count[i] - count[m];
+        if(median < m){
+            median = m;
+        }
+        while(2*(count[median+1] - count[m]) < c){
+            median++;
+        }
+        int64_t error = previous[m] + absoluteError(count, sum, m, median, i);
+        if(error < errorMin){
+            errorMin = error;
+            mMin = m;
+        }
     }
-    for(size_t l = 0; l < nLevels; l++){
-        errorArray[l] = malloc(histogramLength*(sizeof(long)));
+    *split = (uint32_t)mMin;
+    return errorMin;
+}
+
+/* -------------------------------------------------------------------------- */
+
+#define DEFINE_LAYERS(NAME, LENGTH, ERROR, CELL)                              \
+static void NAME(LayerContext* context, size_t id){                           \
+    const size_t n = (LENGTH);                                                \
+    const uint64_t* count = context->count;                                   \
+    const uint64_t* sum = context->sum;                                       \
+    const uint64_t* squares = context->squares;                               \
+    int64_t* previous = context->errors;                                      \
+    int64_t* current = context->errors + n + 1;                               \
+                                                                              \
+    /* One level for the gray levels [0, i) */                                \
+    for(size_t first = 1 + id*CHUNK_LENGTH; first <= n;                       \
+        first += context->nWorkers*CHUNK_LENGTH){                             \
+        for(size_t i = first; i < first + CHUNK_LENGTH && i <= n; i++){       \
+            previous[i] = ERROR(count, sum, squares, 0, i, NULL);             \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    for(size_t k = 2; k <= context->nLevels; k++){                            \
+        if(context->nWorkers > 1){                                            \
+            pthread_barrier_wait(&context->barrier);                          \
+        }                                                                     \
+        uint32_t* split = context->splits + (k-1)*(n+1);                      \
+        for(size_t first = k + id*CHUNK_LENGTH; first <= n;                   \
+            first += context->nWorkers*CHUNK_LENGTH){                         \
+            for(size_t i = first; i < first + CHUNK_LENGTH && i <= n; i++){   \
+                current[i] = CELL(count, sum, squares, previous, k-1, i,      \
+                                  &split[i]);                                 \
+            }                                                                 \
+        }                                                                     \
+        int64_t* swap = previous;                                             \
+        previous = current;                                                   \
+        current = swap;                                                       \
+    }                                                                         \
+}
+
+#ifdef VECTORISED_DP
+DEFINE_LAYERS(defineLayersSmall, SMALL_HISTOGRAM_LENGTH, defineMinError,
+              defineVectorCell)
+DEFINE_LAYERS(defineLayersLarge, context->length, defineMinError,
+              defineVectorCell)
+DEFINE_LAYERS(defineLayersSmallScalar, SMALL_HISTOGRAM_LENGTH, defineMinError,
+              defineCell)
+DEFINE_LAYERS(defineLayersLargeScalar, context->length, defineMinError,
+              defineCell)
+#else
+DEFINE_LAYERS(defineLayersSmall, SMALL_HISTOGRAM_LENGTH, defineMinError,
+              defineCell)
+DEFINE_LAYERS(defineLayersLarge, context->length, defineMinError, defineCell)
+#endif
+DEFINE_LAYERS(defineLayersSmallAbsolute, SMALL_HISTOGRAM_LENGTH,
+              defineMinAbsoluteError, defineAbsoluteCell)
+DEFINE_LAYERS(defineLayersLargeAbsolute, context->length,
+              defineMinAbsoluteError, defineAbsoluteCell)
+
+/* -------------------------------------------------------------------------- */
+
+static void runLayers(LayerContext* context, size_t id){
+    const bool small = context->length == SMALL_HISTOGRAM_LENGTH;
+    if(context->metric == ABSOLUTE_ERROR){
+        if(small){
+            defineLayersSmallAbsolute(context, id);
+        }else{
+            defineLayersLargeAbsolute(context, id);
+        }
+    }else{
+#ifdef VECTORISED_DP
+        //Heavy weights may bring the moments out of reach of the lanes
+        if(context->count[context->length] >= VECTOR_MOMENT_LIMIT ||
+           context->sum[context->length] >= VECTOR_MOMENT_LIMIT){
+            if(small){
+                defineLayersSmallScalar(context, id);
+            }else{
+                defineLayersLargeScalar(context, id);
+            }
+            return;
+        }
+#endif
+        if(small){
+            defineLayersSmall(context, id);
+        }else{
+            defineLayersLarge(context, id);
+        }
     }
-    return errorArray;
 }
 
 /* -------------------------------------------------------------------------- */
 
-long defineMinError(const size_t* histogram, size_t i, size_t j, size_t* level){
-    assert(histogram != NULL || i <= 0 || j <= 0 || level != NULL);
-    
-    long errorMin = LONG_MAX, error = 0;
-    
-    for(size_t k = i; k <= j; k++){
-        error = 0;
-        for(size_t l = i; l <= j; l++){
-            error += (histogram[l]*((l-k)*(l-k)));
+static void* runLayerWorker(void* arg){
+    LayerWorker* worker = arg;
+    LayerContext* context = worker->context;
+
+    //Wait until the number of workers is known
+    pthread_mutex_lock(&context->mutex);
+    while(!context->started){
+        pthread_cond_wait(&context->startCond, &context->mutex);
+    }
+    pthread_mutex_unlock(&context->mutex);
+
+    //The layers may have been left to the calling thread alone
+    if(worker->id < context->nWorkers){
+        runLayers(context, worker->id);
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void defineLayersParallel(LayerContext* context){
+    const size_t nWished = context->nWorkers;
+    pthread_t* threads = malloc(nWished*sizeof(pthread_t));
+    LayerWorker* workers = malloc(nWished*sizeof(LayerWorker));
+    size_t nCreated = 0;
+
+    context->started = false;
+    pthread_mutex_init(&context->mutex, NULL);
+    pthread_cond_init(&context->startCond, NULL);
+
+    //The calling thread is the worker 0
+    if(threads && workers){
+        for(size_t w = 1; w < nWished; w++){
+            workers[w].context = context;
+            workers[w].id = w;
+            if(pthread_create(&threads[w], NULL, runLayerWorker,
+                              &workers[w]) != 0){
+                break;
+            }
+            nCreated++;
         }
-        if(errorMin > error){
-            errorMin = error;
-            *level = k;
+    }
+
+    pthread_mutex_lock(&context->mutex);
+    context->nWorkers = nCreated + 1;
+
+    //Without a barrier, the calling thread defines the layers sequentially
+    if(context->nWorkers > 1 &&
+       pthread_barrier_init(&context->barrier, NULL,
+                            (unsigned)context->nWorkers) != 0){
+        context->nWorkers = 1;
+    }
+    context->started = true;
+    pthread_cond_broadcast(&context->startCond);
+    pthread_mutex_unlock(&context->mutex);
+
+    runLayers(context, 0);
+
+    for(size_t w = 1; w <= nCreated; w++){
+        pthread_join(threads[w], NULL);
+    }
+    if(context->nWorkers > 1){
+        pthread_barrier_destroy(&context->barrier);
+    }
+    pthread_mutex_destroy(&context->mutex);
+    pthread_cond_destroy(&context->startCond);
+    free(threads);
+    free(workers);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void defineLayers(LayerContext* context){
+    if(context->length == SMALL_HISTOGRAM_LENGTH){
+        context->nWorkers = 1;
+        runLayers(context, 0);
+        return;
+    }
+
+    //One thread per core, as long as each has enough cells
+    long nCores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nWorkers = nCores > 1 ? (size_t)nCores : 1;
+    if(nWorkers > context->length/CELLS_PER_THREAD){
+        nWorkers = context->length/CELLS_PER_THREAD > 0
+                 ? context->length/CELLS_PER_THREAD : 1;
+    }
+    context->nWorkers = nWorkers;
+    if(nWorkers > 1){
+        defineLayersParallel(context);
+    }else{
+        runLayers(context, 0);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint64_t defineReduction(ErrorMetric metric, const uint64_t* count,
+                                const uint64_t* sum, const uint64_t* squares,
+                                const uint32_t* splits, size_t length,
+                                size_t nLevels, size_t* thresholds,
+                                uint16_t* levels){
+    //Backtracking from the last level
+    uint64_t error = 0;
+    size_t end = length;
+    for(size_t k = nLevels; k > 0; k--){
+        size_t begin = k > 1 ? splits[(k-1)*(length+1) + end] : 0;
+        error += defineIntervalError(metric, count, sum, squares, begin, end,
+                                     &levels[k-1]);
+        thresholds[k-1] = end;
+        end = begin;
+    }
+    return error;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t defineIdentity(const size_t* histogram, size_t histogramLength,
+                             size_t nLevels, size_t* thresholds,
+                             uint16_t* levels){
+    //Each level spans from its gray level to the next one present
+    size_t nPresent = 0;
+    for(size_t l = 0; l < histogramLength; l++){
+        if(histogram[l] == 0){
+            continue;
+        }
+        if(nPresent == nLevels){
+            return 0;
+        }
+        if(nPresent > 0){
+            thresholds[nPresent-1] = l;
         }
+        levels[nPresent++] = (uint16_t)l;
+    }
+    if(nPresent > 0){
+        thresholds[nPresent-1] = histogramLength;
+    }
+    return nPresent;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void completeReduction(size_t histogramLength, size_t nSolved,
+                              size_t nLevels, size_t* thresholds,
+                              uint16_t* levels){
+    //Levels beyond the real histogram are brought back into it
+    for(size_t k = 0; k < nSolved; k++){
+        if(thresholds[k] > histogramLength){
+            thresholds[k] = histogramLength;
+        }
+        if(levels[k] >= histogramLength){
+            levels[k] = (uint16_t)(histogramLength - 1);
+        }
+    }
+
+    //If there are fewer levels than expected, we still fill thresholds and level.
+    for(size_t k = nSolved; k < nLevels; k++){
+        thresholds[k] = thresholds[nSolved-1];
+        levels[k] = levels[nSolved-1];
     }
-    return errorMin;
 }
 
 /* -------------------------------------------------------------------------- */
 
-bool defineNewGreyLevel(size_t*** newGreyLevel, const size_t* histogram,
-                        size_t histogramLength, size_t nLevels, long** errorArray){
-    if(!newGreyLevel || !histogram || histogramLength <= 0 || nLevels <= 0 ||
-       !errorArray){
+static bool defineCoarseToFine(const uint64_t* count, const uint64_t* sum,
+                               const uint64_t* squares, size_t length,
+                               size_t nLevels, size_t mergeFactor,
+                               size_t window, size_t* thresholds,
+                               uint16_t* levels, ReductionReport* report){
+    const size_t nCoarse = (length + mergeFactor - 1)/mergeFactor;
+
+    uint64_t* coarse = malloc(3*(nCoarse+1)*sizeof(uint64_t));
+    int64_t* errors = malloc(2*(nCoarse+1)*sizeof(int64_t));
+    uint32_t* splits = malloc(nLevels*(nCoarse+1)*sizeof(uint32_t));
+    if(!coarse || !errors || !splits){
+        free(coarse);
+        free(errors);
+        free(splits);
         return false;
     }
-    
+
+    //Merging bins amounts to sampling the prefix moments at their bounds
+    uint64_t* coarseCount = coarse;
+    uint64_t* coarseSum = coarse + (nCoarse+1);
+    uint64_t* coarseSquares = coarse + 2*(nCoarse+1);
+    for(size_t i = 0; i <= nCoarse; i++){
+        size_t bound = i*mergeFactor < length ? i*mergeFactor : length;
+        coarseCount[i] = count[bound];
+        coarseSum[i] = sum[bound];
+        coarseSquares[i] = squares[bound];
+    }
+
+    LayerContext context;
+    context.count = coarseCount;
+    context.sum = coarseSum;
+    context.squares = coarseSquares;
+    context.length = nCoarse;
+    context.nLevels = nLevels;
+    context.metric = SQUARED_ERROR;
+    context.errors = errors;
+    context.splits = splits;
+    context.nWorkers = 1;
+    defineLayers(&context);
+
+    defineReduction(SQUARED_ERROR, coarseCount, coarseSum, coarseSquares,
+                    splits, nCoarse, nLevels, thresholds, levels);
     for(size_t k = 0; k < nLevels; k++){
-        size_t mMemory = 0;
-        
-        for(size_t n = 0; n < histogramLength; n++){
-            if(k == 1){
-                //Level minimize the error if k = 1.
-                size_t level;
-                errorArray[k][n] = defineMinError(histogram, 0, n, &level);
-                
-                for(size_t m = 0; m < histogramLength; m++){
-                    newGreyLevel[k][n][m] = level;
-                }
-                
-            }else if(k >= n){
-                //If k >= n, neither level is modified (no error)
-                errorArray[k][n] = 0;
-                for (size_t m = 0; m < n; m++){
-                    newGreyLevel[k][n][m] = m;
+        thresholds[k] = thresholds[k]*mergeFactor < length
+                      ? thresholds[k]*mergeFactor : length;
+    }
+
+    uint64_t bound = 0, error = 0;
+    bool wentFine = defineLowerBound(coarseCount, coarseSum, coarseSquares,
+                                     nCoarse, nLevels, &bound) &&
+                    refineThresholds(count, sum, squares, length, nLevels,
+                                     window, thresholds, levels, &error);
+
+    report->approximate = true;
+    report->error = error;
+    report->errorBound = error > bound ? error - bound : 0;
+
+    free(coarse);
+    free(errors);
+    free(splits);
+    return wentFine;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool refineThresholds(const uint64_t* count, const uint64_t* sum,
+                             const uint64_t* squares, size_t length,
+                             size_t nLevels, size_t window,
+                             size_t* thresholds, uint16_t* levels,
+                             uint64_t* error){
+    //Threshold k lies in [lower[k], lower[k] + width[k]), p_k being fixed
+    const size_t maxWidth = 2*window + 1;
+    size_t* lower = malloc(2*nLevels*sizeof(size_t));
+    int64_t* errors = malloc(2*maxWidth*sizeof(int64_t));
+    uint32_t* splits = malloc(nLevels*maxWidth*sizeof(uint32_t));
+    if(!lower || !errors || !splits){
+        free(lower);
+        free(errors);
+        free(splits);
+        return false;
+    }
+    size_t* width = lower + nLevels;
+    for(size_t k = 0; k + 1 < nLevels; k++){
+        lower[k] = thresholds[k] > window ? thresholds[k] - window : 1;
+        width[k] = length - lower[k] < maxWidth ? length - lower[k] : maxWidth;
+    }
+    lower[nLevels-1] = length;
+    width[nLevels-1] = 1;
+
+    //The first level covers [0, p_1)
+    int64_t* previous = errors;
+    int64_t* current = errors + maxWidth;
+    for(size_t p = 0; p < width[0]; p++){
+        previous[p] = defineMinError(count, sum, squares, 0, lower[0] + p,
+                                     NULL);
+    }
+
+    for(size_t k = 1; k < nLevels; k++){
+        for(size_t p = 0; p < width[k]; p++){
+            const size_t end = lower[k] + p;
+            int64_t errorMin = INT64_MAX;
+            size_t mMin = 0;
+            for(size_t m = 0; m < width[k-1] && lower[k-1] + m < end; m++){
+                if(previous[m] == INT64_MAX){
+                    continue;
                 }
-                
-            }else if(k == 0 || n == 0){
-                errorArray[k][n] = 0;
-            }else{
-                /*
-                 * Application of the recurrence formula
-                 * mMemory:       m for the one the fomula is the smallest
-                 * levelMemory:   level to apply at n from m+1
-                 */
-                size_t level;
-                errorArray[k][n] = errorArray[k-1][mMemory] +
-                defineMinError(histogram, mMemory + 1, n, &level);
-                
-                size_t levelMemory = level;
-                for(size_t m = mMemory + 1; m <= n; m++){
-                    long minError = errorArray[k-1][m] +
-                    defineMinError(histogram, m + 1, n, &level);
-                    if(minError < errorArray[k][n]){
-                        errorArray[k][n] = defineMinimum(errorArray[k][n],minError);
-                        mMemory = m;
-                        levelMemory = level;
-                    }
+                int64_t candidate = previous[m] +
+                    defineMinError(count, sum, squares, lower[k-1] + m, end,
+                                   NULL);
+                if(candidate < errorMin){
+                    errorMin = candidate;
+                    mMin = m;
                 }
-                for(size_t m = 0; m < mMemory; m++){
-                    newGreyLevel[k][n][m] = newGreyLevel[k-1][mMemory][m];
+            }
+            current[p] = errorMin;
+            splits[k*maxWidth + p] = (uint32_t)mMin;
+        }
+        int64_t* swap = previous;
+        previous = current;
+        current = swap;
+    }
+
+    //Backtracking from the last level, whose threshold is fixed
+    *error = 0;
+    size_t p = 0;
+    for(size_t k = nLevels; k > 0; k--){
+        size_t end = lower[k-1] + p;
+        size_t begin = 0;
+        if(k > 1){
+            p = splits[(k-1)*maxWidth + p];
+            begin = lower[k-2] + p;
+        }
+        *error += defineMinError(count, sum, squares, begin, end,
+                                 &levels[k-1]);
+        thresholds[k-1] = end;
+    }
+
+    free(lower);
+    free(errors);
+    free(splits);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool defineLowerBound(const uint64_t* count, const uint64_t* sum,
+                             const uint64_t* squares, size_t length,
+                             size_t nLevels, uint64_t* bound){
+    int64_t* errors = malloc(3*(length+1)*sizeof(int64_t));
+    if(!errors){
+        return false;
+    }
+    int64_t* previous = errors;
+    int64_t* current = errors + (length+1);
+    int64_t* start = errors + 2*(length+1);
+
+    //No level covers no bin
+    previous[0] = 0;
+    for(size_t e = 1; e <= length; e++){
+        previous[e] = INT64_MAX;
+    }
+
+    int64_t skipLast = INT64_MAX;
+    for(size_t k = 1; k <= nLevels; k++){
+        //Level k may start at s, possibly after leaving bin s-1 out
+        for(size_t s = 0; s <= length; s++){
+            start[s] = previous[s];
+            if(s > 0 && previous[s-1] < start[s]){
+                start[s] = previous[s-1];
+            }
+        }
+
+        current[0] = 0;
+        for(size_t e = 1; e <= length; e++){
+            //Level k may also cover no bin at all
+            int64_t errorMin = previous[e];
+            for(size_t s = 0; s < e; s++){
+                if(start[s] == INT64_MAX){
+                    continue;
                 }
-                for(size_t m = mMemory+1; m < n; m++){
-                    newGreyLevel[k][n][m] = levelMemory;
+                int64_t candidate = start[s] +
+                    defineMinError(count, sum, squares, s, e, NULL);
+                if(candidate < errorMin){
+                    errorMin = candidate;
                 }
             }
+            current[e] = errorMin;
         }
+
+        //The last bin may hold the last threshold p_{k-1}
+        skipLast = previous[length-1];
+        int64_t* swap = previous;
+        previous = current;
+        current = swap;
     }
+
+    int64_t lowest = previous[length] < skipLast ? previous[length] : skipLast;
+    *bound = (uint64_t)lowest;
+    free(errors);
     return true;
 }
 
 /* -------------------------------------------------------------------------- */
 
 bool computeReduction(const size_t* histogram, size_t histogramLength,
-                          size_t nLevels, size_t* thresholds, uint16_t* levels){
-    
-    bool wentFine = false;
-    
+                      size_t nLevels, size_t* thresholds, uint16_t* levels){
+    return computeReductionWithSettings(histogram, histogramLength, nLevels,
+                                        thresholds, levels, NULL, NULL);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool computeReductionWithSettings(const size_t* histogram,
+                                  size_t histogramLength, size_t nLevels,
+                                  size_t* thresholds, uint16_t* levels,
+                                  const ReductionSettings* settings,
+                                  ReductionReport* report){
+
     if(!histogram || histogramLength <= 0 || nLevels <= 0 || !thresholds ||
        !levels){
-        wentFine = false;
-        return wentFine;
-    }
-    
-    size_t*** newGreyLevel = createNewGreyLevel(nLevels, histogramLength);
-    if(!newGreyLevel){
-        wentFine = false;
-        return wentFine;
-    }
-    
-    long** errorArray = createErrorArray(nLevels, histogramLength);
-    if(!errorArray){
-        free(newGreyLevel);
-        wentFine = false;
-        return wentFine;
-    }
-    
-    if(!defineNewGreyLevel(newGreyLevel, histogram, histogramLength, nLevels,
-                           errorArray)){
-        free(newGreyLevel);
-        free(errorArray);
-        wentFine = false;
-        return wentFine;
-    }
-    
-    //Using of newGreyLevel to fill levels and thresholds vector.
-    size_t k = 0;
-    levels[k] = newGreyLevel[nLevels-1][histogramLength-1][0];
-    
-    for(size_t m = 1; m < histogramLength; m++){
-        if(levels[k] != newGreyLevel[nLevels-1][histogramLength-1][m]){
-            thresholds[k++] = m;
-            levels[k] = newGreyLevel[nLevels-1][histogramLength-1][m];
+        return false;
+    }
+    if(!settings){
+        settings = getDefaultReductionSettings();
+    }
+
+    //Enough levels for all the gray levels present: nothing to reduce
+    const size_t nPresent = defineIdentity(histogram, histogramLength,
+                                           nLevels, thresholds, levels);
+    if(nPresent > 0){
+        completeReduction(histogramLength, nPresent, nLevels, thresholds,
+                          levels);
+        if(report){
+            ReductionReport newReport = {false, 0, 0};
+            *report = newReport;
         }
+        return true;
     }
-    //If there are fewer levels than expected, we still fill thresholds and level.
-    if(k < nLevels){
-        for(size_t m = k; m < nLevels; m++){
-            thresholds[m] = thresholds[m-1];
-            levels[m+1] = levels[m];
+
+    /*
+     * Small histograms are padded with empty bins so that their tables have
+     * a fixed size and live on the stack.
+     */
+    const bool small = histogramLength <= SMALL_HISTOGRAM_LENGTH;
+    const size_t length = small ? SMALL_HISTOGRAM_LENGTH : histogramLength;
+    const size_t nSolved = nLevels < length ? nLevels : length;
+
+    /*
+     * Large histograms may be reduced coarse-to-fine, as long as the error is
+     * squared: merged bins only keep the moments of their pixels, which do
+     * not tell where their median is.
+     */
+    const bool coarseToFine = !small && settings->mergeFactor > 1 &&
+                              settings->metric == SQUARED_ERROR &&
+                              length/settings->mergeFactor >= nSolved;
+
+    uint64_t smallMoments[3][SMALL_HISTOGRAM_LENGTH + 1];
+    int64_t smallErrors[2*(SMALL_HISTOGRAM_LENGTH + 1)];
+    uint64_t* moments = small ? &smallMoments[0][0]
+                              : malloc(3*(length+1)*sizeof(uint64_t));
+    int64_t* errors = NULL;
+    uint32_t* splits = NULL;
+    if(!coarseToFine){
+        errors = small ? smallErrors : malloc(2*(length+1)*sizeof(int64_t));
+        splits = malloc(nSolved*(length+1)*sizeof(uint32_t));
+    }
+    if(!moments || (!coarseToFine && (!errors || !splits))){
+        if(!small){
+            free(moments);
+            free(errors);
         }
+        free(splits);
+        return false;
+    }
+
+    uint64_t* count = moments;
+    uint64_t* sum = moments + (length+1);
+    uint64_t* squares = moments + 2*(length+1);
+    bool wentFine = computeMoments(histogram, histogramLength, length,
+                                   settings->weights, settings->weightsLength,
+                                   count, sum, squares);
+
+    ReductionReport newReport = {false, 0, 0};
+    if(wentFine && coarseToFine){
+        size_t window = settings->refineWindow > 0 ? settings->refineWindow
+                                                   : settings->mergeFactor;
+        wentFine = defineCoarseToFine(count, sum, squares, length, nSolved,
+                                      settings->mergeFactor, window,
+                                      thresholds, levels, &newReport);
+    }else if(wentFine){
+        LayerContext context;
+        context.count = count;
+        context.sum = sum;
+        context.squares = squares;
+        context.length = length;
+        context.nLevels = nSolved;
+        context.metric = settings->metric;
+        context.errors = errors;
+        context.splits = splits;
+        context.nWorkers = 1;
+        defineLayers(&context);
+
+        newReport.error = defineReduction(settings->metric, count, sum,
+                                          squares, splits, length, nSolved,
+                                          thresholds, levels);
     }
-    
-    free(newGreyLevel);
-    free(errorArray);
-    wentFine = true;
-    
+
+    if(wentFine){
+        completeReduction(histogramLength, nSolved, nLevels, thresholds,
+                          levels);
+        if(report){
+            *report = newReport;
+        }
+    }
+
+    if(!small){
+        free(moments);
+        free(errors);
+    }
+    free(splits);
     return wentFine;
 }
-
@@ -0,0 +1,225 @@
+/***********************************************************************
+ * GrayMapping
+ * Implementation of the interface GrayMapping.h
+ ************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "GrayMapping.h"
+#include "PortableGrayMap.h"
+
+// Largest histogram, gray levels being stored on 16 bits
+#define MAX_LENGTH 65536
+
+/***********************************************************************
+ * Write an unsigned integer on a number of bytes, least significant
+ * byte first.
+ ***********************************************************************/
+static void writeInteger(FILE* file, uint64_t value, size_t nBytes)
+{
+  for (size_t b = 0; b < nBytes; ++b)
+    fputc((int)((value >> (8 * b)) & 0xFF), file);
+}
+
+/***********************************************************************
+ * Read an unsigned integer stored on a number of bytes, least
+ * significant byte first.
+ ***********************************************************************/
+static int readInteger(FILE* file, uint64_t* value, size_t nBytes)
+{
+  *value = 0;
+  for (size_t b = 0; b < nBytes; ++b)
+  {
+    int byte = fgetc(file);
+    if (byte == EOF)
+      return -1;
+    *value |= (uint64_t)byte << (8 * b);
+  }
+  return 0;
+}
+
+/***********************************************************************
+ * Write a vector of values as a JSON array.
+ ***********************************************************************/
+static void writeJsonSizes(FILE* file, const size_t* values, size_t length)
+{
+  fputc('[', file);
+  for (size_t i = 0; i < length; ++i)
+    fprintf(file, i == 0 ? "%zu" : ",%zu", values[i]);
+  fputc(']', file);
+}
+
+static void writeJsonLevels(FILE* file, const uint16_t* values, size_t length)
+{
+  fputc('[', file);
+  for (size_t i = 0; i < length; ++i)
+    fprintf(file, i == 0 ? "%u" : ",%u", values[i]);
+  fputc(']', file);
+}
+
+GrayMapping* createEmptyMapping(size_t length, size_t numLevels)
+{
+  if (length == 0 || numLevels == 0)
+    return NULL;
+
+  GrayMapping* res = malloc(sizeof(GrayMapping));
+  if (res == NULL)
+    return NULL;
+
+  res->numLevels = numLevels;
+  res->length = length;
+  res->error = 0;
+  res->thresholds = malloc(numLevels * sizeof(size_t));
+  res->levels = malloc(numLevels * sizeof(uint16_t));
+  res->lut = malloc(length * sizeof(uint16_t));
+  if (res->thresholds == NULL || res->levels == NULL || res->lut == NULL)
+  {
+    deleteMapping(res);
+    return NULL;
+  }
+
+  return res;
+}
+
+void deleteMapping(GrayMapping* mapping)
+{
+  if (mapping == NULL)
+    return;
+  free(mapping->thresholds);
+  free(mapping->levels);
+  free(mapping->lut);
+  free(mapping);
+  return;
+}
+
+size_t* createHistogramFromStream(FILE* file, size_t* length)
+{
+  if (file == NULL || length == NULL)
+    return NULL;
+
+  size_t* res = malloc(MAX_LENGTH * sizeof(size_t));
+  if (res == NULL)
+    return NULL;
+
+  // Skip white spaces, the first character telling the format
+  int nextChar = fgetc(file);
+  while (nextChar != EOF && isspace(nextChar))
+    nextChar = fgetc(file);
+
+  *length = 0;
+  if (nextChar == 'Q')
+  {
+    // Binary histogram
+    uint64_t value = 0;
+    if (fgetc(file) != 'H' || fgetc(file) != 'S' || fgetc(file) != 'T' ||
+        readInteger(file, &value, 4) != 0 || value == 0 ||
+        value > MAX_LENGTH)
+    {
+      free(res);
+      return NULL;
+    }
+    *length = (size_t)value;
+    for (size_t i = 0; i < *length; ++i)
+    {
+      if (readInteger(file, &value, 8) != 0 || value > SIZE_MAX)
+      {
+        free(res);
+        return NULL;
+      }
+      res[i] = (size_t)value;
+    }
+  }
+  else
+  {
+    // Text histogram
+    while (nextChar != EOF)
+    {
+      if (nextChar == '#')
+        while (nextChar != EOF && nextChar != '\n')
+          nextChar = fgetc(file);
+      else if (isdigit(nextChar))
+      {
+        if (*length == MAX_LENGTH)
+        {
+          free(res);
+          return NULL;
+        }
+        size_t value = 0;
+        while (isdigit(nextChar))
+        {
+          const size_t digit = (size_t)(nextChar - '0');
+          if (value > (SIZE_MAX - digit) / 10)
+          {
+            free(res);
+            return NULL;
+          }
+          value = value * 10 + digit;
+          nextChar = fgetc(file);
+        }
+        res[(*length)++] = value;
+        continue;
+      }
+      else if (!isspace(nextChar))
+      {
+        free(res);
+        return NULL;
+      }
+      nextChar = fgetc(file);
+    }
+    if (*length == 0)
+    {
+      free(res);
+      return NULL;
+    }
+  }
+
+  return res;
+}
+
+int saveMappingToFile(const GrayMapping* mapping, const char* filename,
+                      GrayMappingFormat format)
+{
+  if (mapping == NULL || filename == NULL)
+    return -1;
+
+  FILE* file = openImageFile(filename, true);
+  if (file == NULL)
+  {
+    return -1;
+  }
+
+  if (format == MAPPING_BINARY)
+  {
+    fputs("QMAP", file);
+    writeInteger(file, mapping->numLevels, 4);
+    writeInteger(file, mapping->length, 4);
+    writeInteger(file, mapping->error, 8);
+    for (size_t k = 0; k < mapping->numLevels; ++k)
+      writeInteger(file, mapping->thresholds[k], 4);
+    for (size_t k = 0; k < mapping->numLevels; ++k)
+      writeInteger(file, mapping->levels[k], 2);
+    for (size_t i = 0; i < mapping->length; ++i)
+      writeInteger(file, mapping->lut[i], 2);
+  }
+  else
+  {
+    fprintf(file, "{\"numLevels\":%zu,\"length\":%zu,\"error\":%" PRIu64
+            ",\"thresholds\":", mapping->numLevels, mapping->length,
+            mapping->error);
+    writeJsonSizes(file, mapping->thresholds, mapping->numLevels);
+    fprintf(file, ",\"levels\":");
+    writeJsonLevels(file, mapping->levels, mapping->numLevels);
+    fprintf(file, ",\"lut\":");
+    writeJsonLevels(file, mapping->lut, mapping->length);
+    fprintf(file, "}\n");
+  }
+
+  int failed = ferror(file);
+  if (closeImageFile(file) != 0)
+    failed = 1;
+  return failed ? -1 : 0;
+}
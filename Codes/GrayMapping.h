@@ -0,0 +1,102 @@
+/***********************************************************************
+ * GrayMapping
+ * Representation of the mapping function g of a reduction, along with
+ * the files it is exchanged through: histograms as inputs, thresholds,
+ * levels and lookup table as outputs.
+ *
+ * Histogram files are either text, the counts of the gray levels
+ * 0, 1, ..., n-1 separated by white spaces ('#' starting a comment), or
+ * binary, made of the 4 bytes "QHST", n on 4 bytes, then the n counts on
+ * 8 bytes each.
+ *
+ * Binary mapping files are made of the 4 bytes "QMAP", k and n on 4
+ * bytes each, the error on 8 bytes, the k thresholds on 4 bytes each,
+ * then the k levels and the n entries of the lookup table on 2 bytes
+ * each. All the integers are stored least significant byte first.
+ ***********************************************************************/
+
+#ifndef _GRAY_MAPPING_H_
+#define _GRAY_MAPPING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Types */
+
+/* File format of a mapping */
+typedef enum
+{
+  MAPPING_BINARY,
+  MAPPING_JSON
+} GrayMappingFormat;
+
+/* Mapping function g of a reduction of n gray levels on k levels */
+typedef struct
+{
+  size_t numLevels;             // Number of levels (k)
+  size_t length;                // Number of gray levels mapped (n)
+  size_t* thresholds;           // Thresholds (p_1, ..., p_k = n)
+  uint16_t* levels;             // Levels (v_1, ..., v_k)
+  uint16_t* lut;                // g(i) at index i, of size n
+  uint64_t error;               // Error of the mapping, with the metric
+                                // and weights of its ReductionSettings
+} GrayMapping;
+
+/* Functions */
+
+/***********************************************************************
+ * Create a mapping whose thresholds, levels and lookup table are
+ * allocated but not initialized.
+ * The mapping must later be deleted by calling deleteMapping().
+ *
+ * PARAMETERS
+ * length       - The number of gray levels mapped (n > 0)
+ * numLevels    - The number of levels (k > 0)
+ *
+ * RETURN
+ * NULL         - if any error
+ * mapping      - The new mapping
+ ***********************************************************************/
+GrayMapping* createEmptyMapping(size_t length, size_t numLevels);
+
+/***********************************************************************
+ * Delete a mapping.
+ *
+ * PARAMETER
+ * mapping      - The mapping to destroy.
+ ***********************************************************************/
+void deleteMapping(GrayMapping* mapping);
+
+/***********************************************************************
+ * Read a histogram, text or binary, from the current position of a
+ * stream up to its end.
+ * The histogram must later be freed by calling free().
+ *
+ * PARAMETERS
+ * file         - A stream opened for reading
+ * length       - A valid pointer where the size of the histogram (n)
+ *                will be stored
+ *
+ * RETURN
+ * NULL         - if any error
+ * histogram    - The n counts of the gray levels
+ ***********************************************************************/
+size_t* createHistogramFromStream(FILE* file, size_t* length);
+
+/***********************************************************************
+ * Save a mapping to a file.
+ *
+ * PARAMETERS
+ * mapping      - The mapping to save
+ * filename     - Destination file name, opened by openImageFile()
+ * format       - The format of the file
+ *
+ * RETURN
+ * 0            - If no error
+ * non-0        - Otherwise
+ ***********************************************************************/
+int saveMappingToFile(const GrayMapping* mapping, const char* filename,
+                      GrayMappingFormat format);
+
+#endif // !_GRAY_MAPPING_H_
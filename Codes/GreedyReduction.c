@@ -148,8 +148,25 @@ static bool defineLevels(const size_t* histogram, size_t histogramLength,
 
 bool computeReduction(const size_t* histogram, size_t histogramLength,
                       size_t nLevels, size_t* thresholds, uint16_t* levels){
+    return computeReductionWithSettings(histogram, histogramLength, nLevels,
+                                        thresholds, levels, NULL, NULL);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool computeReductionWithSettings(const size_t* histogram,
+                                  size_t histogramLength, size_t nLevels,
+                                  size_t* thresholds, uint16_t* levels,
+                                  const ReductionSettings* settings,
+                                  ReductionReport* report){
     bool wentFine;
 
+    //The greedy thresholds neither use the settings nor bound their error
+    (void)settings;
+    if(report){
+        *report = (ReductionReport){false, 0, 0};
+    }
+
     if(!histogram || histogramLength <= 0 || nLevels <= 0 || !thresholds ||
        !levels){
         wentFine = false;
@@ -6,117 +6,1538 @@
  *                                  HEADER                                    *
  * ========================================================================== */
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "ImageQuantizer.h"
 #include "Reduction.h"
+#include "ReductionSettings.h"
+
+// Number of bins of the tables of the 8-bit and 16-bit kernels
+#define BINS_8 256
+#define BINS_16 65536
+
+// Number of interleaved partial histograms of the 8-bit kernel
+#define LANES_8 4
+
+/*
+ * Automatic sampling: a heuristic number of samples, growing as k^2 so that
+ * the finer reductions get finer histograms. The samples lie on a fixed
+ * lattice, not at independent random positions, so that no confidence bound
+ * on the estimated histogram holds; an image whose pattern follows the
+ * lattice may be badly estimated, all its pixels being then needed.
+ */
+#define SAMPLES_PER_SQUARED_LEVEL 973
+#define MIN_SAMPLES 65536
+
+// Largest number of bins of the histogram of wide samples
+#define WIDE_BINS 4096
+
+/* ========================================================================== *
+ *                                   TYPES                                    *
+ * ========================================================================== */
+
+/* Share of the images of a batch treated by a thread */
+typedef struct {
+    PortableGrayMap** images;   // Images of the batch
+    size_t nImages;             // Number of images of the batch
+    size_t first;               // First image of the thread
+    size_t step;                // Number of threads (gap between its images)
+    size_t* histogram;          // Histogram of its images, of size BINS
+    const uint16_t* lut;        // Shared lookup table, of size BINS
+    const uint64_t* costs;      // Shared errors of the gray levels
+    uint64_t* errors;           // Error of each image of the batch
+} BatchWorker;
+
+/* Lattice of the pixels sampled to estimate the histogram of an image */
+typedef struct {
+    size_t rowStep;             // One row out of rowStep, from rowStep/2
+    size_t columnStep;          // One pixel out of columnStep in a row
+    uint64_t random;            // Xorshift state giving the row offsets
+} SampleLattice;
+
+/* Rows of a wide view treated by a thread */
+typedef struct {
+    const WideImageView* view;  // Samples to treat
+    const WideImageView* res;   // Samples receiving the result
+    size_t firstRow;            // Rows [firstRow, lastRow) of the thread
+    size_t lastRow;
+    double lowest;              // Range of its samples
+    double highest;
+    bool finite;                // Whether its samples are all finite
+    double offset;              // The bin of x is (x - offset)*scale,
+    double scale;               // clamped to [0, nBins-1]
+    size_t nBins;
+    size_t* histogram;          // Number of its samples in each bin
+    double* sums;               // Sum of its samples in each bin
+    const size_t* thresholds;   // Thresholds of the reduction, on the bins
+    const double* levels;       // Levels of the reduction
+    size_t numLevels;
+    ErrorMetric metric;         // Error of a sample
+    const size_t* weights;      // Weights of the bins (NULL: all 1)
+    size_t weightsLength;
+    double error;               // Error made on its samples
+} WideWorker;
 
 /* ========================================================================== *
  *                                 PROTOTYPES                                 *
  * ========================================================================== */
 
+/* -------------------------------------------------------------------------- *
+ * Count the pixels of each gray level, in LANES interleaved partial          *
+ * histograms so that consecutive pixels of the same level do not wait on     *
+ * each other. These kernels are generated for 8-bit and 16-bit images.       *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image        The image to treat                                            *
+ * counters     A vector of LANES*BINS zeros                                  *
+ * -------------------------------------------------------------------------- */
+static void countPixels8(const PortableGrayMap* image, size_t* counters);
+static void countPixels16(const PortableGrayMap* image, size_t* counters);
+
+/* -------------------------------------------------------------------------- *
+ * Replace each pixel by its entry in a lookup table. These kernels are       *
+ * generated for 8-bit and 16-bit images.                                     *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image        The image to treat                                            *
+ * lut          The lookup table, of size BINS                                *
+ * res          An image of the same size as image, receiving the result      *
+ * -------------------------------------------------------------------------- */
+static void remapPixels8(const PortableGrayMap* image, const uint16_t* lut,
+                         PortableGrayMap* res);
+static void remapPixels16(const PortableGrayMap* image, const uint16_t* lut,
+                          PortableGrayMap* res);
+
+/* -------------------------------------------------------------------------- *
+ * Replace each pixel by its entry in a lookup table, in place, and sum the   *
+ * errors made on the way. These kernels are generated for 8-bit and 16-bit   *
+ * images.                                                                    *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image        The image to treat, receiving the result                      *
+ * lut          The lookup table, of size BINS                                *
+ * costs        The error made on a pixel of each gray level, of size BINS    *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * error        The error between the old and new pixels                      *
+ * -------------------------------------------------------------------------- */
+static uint64_t remapPixelsInPlace8(PortableGrayMap* image,
+                                    const uint16_t* lut,
+                                    const uint64_t* costs);
+static uint64_t remapPixelsInPlace16(PortableGrayMap* image,
+                                     const uint16_t* lut,
+                                     const uint64_t* costs);
+
+/* -------------------------------------------------------------------------- *
+ * Count the pixels of each gray level of a view, as countPixels does. These  *
+ * kernels are generated for 8-bit and 16-bit pixels.                         *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * view         The pixels to treat                                           *
+ * counters     A vector of LANES*BINS zeros                                  *
+ * -------------------------------------------------------------------------- */
+static void countViewPixels8(const GrayImageView* view, size_t* counters);
+static void countViewPixels16(const GrayImageView* view, size_t* counters);
+
+/* -------------------------------------------------------------------------- *
+ * Write the entry of each pixel of a view in a lookup table to another view, *
+ * which may be the same one, and sum the errors made on the way. These       *
+ * kernels are generated for every pair of 8-bit and 16-bit pixels.           *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * view         The pixels to treat                                           *
+ * lut          The lookup table, of size BINS of the input pixels            *
+ * costs        The error made on a pixel of each gray level, of size BINS    *
+ * res          A view of the same size as view, receiving the result         *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * error        The error between the old and new pixels                      *
+ * -------------------------------------------------------------------------- */
+static uint64_t remapViewPixels8To8(const GrayImageView* view,
+                                    const uint16_t* lut,
+                                    const uint64_t* costs,
+                                    const GrayImageView* res);
+static uint64_t remapViewPixels8To16(const GrayImageView* view,
+                                     const uint16_t* lut,
+                                     const uint64_t* costs,
+                                     const GrayImageView* res);
+static uint64_t remapViewPixels16To8(const GrayImageView* view,
+                                     const uint16_t* lut,
+                                     const uint64_t* costs,
+                                     const GrayImageView* res);
+static uint64_t remapViewPixels16To16(const GrayImageView* view,
+                                      const uint16_t* lut,
+                                      const uint64_t* costs,
+                                      const GrayImageView* res);
+
+/* -------------------------------------------------------------------------- *
+ * Tell whether a view describes valid pixels                                 *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * view         The view to check                                             *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true         If its pixels, bit depth, stride and maxValue are consistent  *
+ * false        Else                                                          *
+ * -------------------------------------------------------------------------- */
+static bool isValidView(const GrayImageView* view);
+
+/* -------------------------------------------------------------------------- *
+ * Tell whether a wide view describes valid samples                           *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * view         The view to check                                             *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true         If its samples, format and stride are consistent              *
+ * false        Else                                                          *
+ * -------------------------------------------------------------------------- */
+static bool isValidWideView(const WideImageView* view);
+
+/* -------------------------------------------------------------------------- *
+ * Read or write a sample of a row of a wide view                             *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * view         The view                                                      *
+ * row          The first byte of the row                                     *
+ * j            The index of the sample in the row                            *
+ * value        The value to write, representable in the format of the view   *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * sample       The value of the sample read                                  *
+ * -------------------------------------------------------------------------- */
+static inline double readWideSample(const WideImageView* view,
+                                    const unsigned char* row, size_t j);
+static inline void writeWideSample(const WideImageView* view,
+                                   unsigned char* row, size_t j,
+                                   double value);
+
+/* -------------------------------------------------------------------------- *
+ * Define the bin of a wide sample                                            *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * worker       The worker holding the binning                                *
+ * value        The value of the sample                                       *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * bin          The bin of the sample (< nBins)                               *
+ * -------------------------------------------------------------------------- */
+static inline size_t defineWideBin(const WideWorker* worker, double value);
+
+/* -------------------------------------------------------------------------- *
+ * Bodies of the threads sharing the rows of a wide view: the first one       *
+ * finds the range of the samples, the second one counts and sums them in     *
+ * their bins, and the third one remaps them with the levels of the           *
+ * reduction, found by a binary search of their bins in the thresholds        *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * arg          A valid pointer to the WideWorker of the thread               *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * NULL         Always                                                        *
+ * -------------------------------------------------------------------------- */
+static void* scanWideRows(void* arg);
+static void* countWideRows(void* arg);
+static void* remapWideRows(void* arg);
+
+/* -------------------------------------------------------------------------- *
+ * Add the number of pixels of each gray level of an image to a histogram     *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image        The image to treat                                            *
+ * histogram    A vector of BINS_8 (if maxValue < BINS_8) or BINS_16 values   *
+ * -------------------------------------------------------------------------- */
+static void accumulateHistogram(const PortableGrayMap* image,
+                                size_t* histogram);
+
 /* -------------------------------------------------------------------------- *
  * Create the histogram of a given image                                      *
  *                                                                            *
  * PARAMETERS                                                                 *
  * image        The image to treat                                            *
+ * histogram    A vector of BINS_8 (if maxValue < BINS_8) or BINS_16 values   *
+ *              who will contain the number of pixel of each gray level       *
+ * -------------------------------------------------------------------------- */
+static void createHistogram(const PortableGrayMap* image, size_t* histogram);
+
+/* -------------------------------------------------------------------------- *
+ * Define the fraction of the pixels that builds the histogram                *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * nPixels      The number of pixels of the image                             *
+ * numLevels    The number of levels of the reduction (k)                     *
+ * rate         The rate asked (0 or >= 1: all pixels, < 0: automatic)        *
  *                                                                            *
  * RETURNS                                                                    *
- * hsitogram    An vector who contains the number of pixel of a gray level    *
+ * rate         The rate to use, 1 meaning all the pixels                     *
+ * -------------------------------------------------------------------------- */
+static double defineSamplingRate(size_t nPixels, size_t numLevels,
+                                 double rate);
+
+/* -------------------------------------------------------------------------- *
+ * Define the lattice of the pixels sampled in an image: one row out of       *
+ * rowStep, and in each of them one pixel out of columnStep from a random     *
+ * offset, such that rowStep*columnStep is about 1/rate                       *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * height       The number of rows of the image                               *
+ * rate         The fraction of the pixels to use (< 1)                       *
+ * lattice      A pointer where the lattice is stored                         *
  * -------------------------------------------------------------------------- */
-static size_t* createHistogram(const PortableGrayMap* image);
+static void createSampleLattice(size_t height, double rate,
+                                SampleLattice* lattice);
+
+/* -------------------------------------------------------------------------- *
+ * Add the samples of the next sampled row of an image to a histogram, the    *
+ * rows being given in order                                                  *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * lattice      The lattice of the samples, whose offsets advance             *
+ * row          The row to sample                                             *
+ * width        The number of pixels of the row                               *
+ * bins         The size of the histogram (BINS_8 or BINS_16)                 *
+ * histogram    The histogram to update                                       *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * nSamples     The number of pixels counted                                  *
+ * -------------------------------------------------------------------------- */
+static size_t sampleRow(SampleLattice* lattice, const uint16_t* row,
+                        size_t width, size_t bins, size_t* histogram);
+
+/* -------------------------------------------------------------------------- *
+ * Create the histogram of the pixels of an image lying on the lattice        *
+ * defined by createSampleLattice                                             *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image        The image to treat                                            *
+ * histogram    A vector as for createHistogram                               *
+ * rate         The fraction of the pixels to use (< 1)                       *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * nSamples     The number of pixels counted                                  *
+ * -------------------------------------------------------------------------- */
+static size_t createSampledHistogram(const PortableGrayMap* image,
+                                     size_t* histogram, double rate);
+
+/* -------------------------------------------------------------------------- *
+ * Create the histogram of an image, on all its pixels or on a sample of them *
+ * as asked by the reduction settings                                         *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image        The image to treat                                            *
+ * numLevels    The number of levels of the reduction (k)                     *
+ * settings     The settings of the reduction                                 *
+ * histogram    A vector as for createHistogram                               *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * nCounted     The number of pixels counted in the histogram                 *
+ * -------------------------------------------------------------------------- */
+static size_t fillHistogram(const PortableGrayMap* image, size_t numLevels,
+                            const ReductionSettings* settings,
+                            size_t* histogram);
+
+/* -------------------------------------------------------------------------- *
+ * Create the lookup table of the mapping function g defined by a reduction   *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * thresholds   The thresholds (p_1, ..., p_k) of the reduction               *
+ * levels       The levels (v_1, ..., v_k) of the reduction                   *
+ * numLevels    The number of levels of the reduction (k)                     *
+ * length       The size of the lookup table                                  *
+ * lut          A vector of size length who will contain g(i) at index i      *
+ * -------------------------------------------------------------------------- */
+static void createLookupTable(const size_t* thresholds, const uint16_t* levels,
+                              size_t numLevels, size_t length, uint16_t* lut);
+
+/* -------------------------------------------------------------------------- *
+ * Compute the optimal reduction of an image and its lookup table             *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image        The image to treat                                            *
+ * numLevels    The number of levels of the reduction (k)                     *
+ * settings     The settings of the reduction                                 *
+ * levels       A vector of size k who will contain the levels                *
+ * lut          A vector of BINS_8 (if maxValue < BINS_8) or BINS_16 values   *
+ *              who will contain the lookup table                             *
+ * report       A pointer where the report of the reduction is stored (NULL   *
+ *              if not needed)                                                *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true         If the reduction was computed                                 *
+ * false        Else                                                          *
+ * -------------------------------------------------------------------------- */
+static bool defineLookupTable(const PortableGrayMap* image, size_t numLevels,
+                              const ReductionSettings* settings,
+                              uint16_t* levels, uint16_t* lut,
+                              ReductionReport* report);
+
+/* -------------------------------------------------------------------------- *
+ * Create the table of the error made on a pixel of each gray level i by the  *
+ * mapping function g, that is w[i]d(i, g(i)) with the metric and weights of  *
+ * the reduction settings                                                     *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * lut          The lookup table of the mapping function g                    *
+ * length       Size of the lookup table (n)                                  *
+ * settings     The settings of the reduction                                 *
+ * costs        A vector of size length who will contain the errors           *
+ * -------------------------------------------------------------------------- */
+static void createCostTable(const uint16_t* lut, size_t length,
+                            const ReductionSettings* settings,
+                            uint64_t* costs);
+
+/* -------------------------------------------------------------------------- *
+ * Compute the error of a mapping function on a histogram                     *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * histogram    The histogram vector (h)                                      *
+ * length       Size of the histogram vector and of the lookup table (n)      *
+ * lut          The lookup table of the mapping function g                    *
+ * settings     The settings of the reduction                                 *
+ * error        A pointer where \sum_{i=0}^{n-1} w[i]h[i]d(i, g(i)) is stored *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true         If the error was computed                                     *
+ * false        If any error                                                  *
+ * -------------------------------------------------------------------------- */
+static bool computeMappingError(const size_t* histogram, size_t length,
+                                const uint16_t* lut,
+                                const ReductionSettings* settings,
+                                uint64_t* error);
+
+/* -------------------------------------------------------------------------- *
+ * Define the max value of a quantized image, which only needs to cover its   *
+ * levels, but is at least 1 so that netpbm readers accept it                 *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * levels       The sorted levels of the reduction                            *
+ * numLevels    The number of levels (> 0)                                    *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * maxValue     The max value of the quantized image                          *
+ * -------------------------------------------------------------------------- */
+static uint16_t defineMaxValue(const uint16_t* levels, size_t numLevels);
+
+/* -------------------------------------------------------------------------- *
+ * Bodies of the threads sharing a batch: the first one adds the pixels of    *
+ * the images to the histogram of the thread, the second one remaps them in   *
+ * place with the shared lookup table                                         *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * arg          A valid pointer to the BatchWorker of the thread              *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * NULL         Always                                                        *
+ * -------------------------------------------------------------------------- */
+static void* countBatchPixels(void* arg);
+static void* remapBatchPixels(void* arg);
+
+/* -------------------------------------------------------------------------- *
+ * Run a body on workers, the calling thread being the worker 0, and wait for *
+ * all of them                                                                *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * workers      The vector of the workers                                     *
+ * workerSize   The size of a worker                                          *
+ * nWorkers     The number of workers                                         *
+ * body         The body to run on each of them                               *
+ * -------------------------------------------------------------------------- */
+static void runWorkers(void* workers, size_t workerSize, size_t nWorkers,
+                       void* (*body)(void*));
 
 /* ========================================================================== *
  *                                  FUNCTIONS                                 *
  * ========================================================================== */
-static size_t* createHistogram(const PortableGrayMap* image){
-    
-    //Dynamic memory allocation of the histogram vector
-    size_t* histogram = malloc(sizeof(size_t)*(image->maxValue+1));
-    
-    if(!histogram){
-        return NULL;
+
+/*
+ * Pixels are masked with BINS-1 so that the compiler knows that they stay in
+ * the tables; the reader guarantees they do not exceed maxValue.
+ */
+#define DEFINE_KERNELS(BITS, BINS, LANES)                                     \
+static void countPixels##BITS(const PortableGrayMap* image,                   \
+                              size_t* counters){                              \
+    for(size_t i = 0; i < image->height; i++){                                \
+        const uint16_t* row = image->array[i];                                \
+        size_t j = 0;                                                         \
+        for(; j + (LANES) <= image->width; j += (LANES)){                     \
+            for(size_t l = 0; l < (LANES); l++){                              \
+                counters[l*(BINS) + (row[j+l] & ((BINS)-1))]++;               \
+            }                                                                 \
+        }                                                                     \
+        for(; j < image->width; j++){                                         \
+            counters[row[j] & ((BINS)-1)]++;                                  \
+        }                                                                     \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static void remapPixels##BITS(const PortableGrayMap* image,                   \
+                              const uint16_t* lut, PortableGrayMap* res){     \
+    for(size_t i = 0; i < image->height; i++){                                \
+        const uint16_t* row = image->array[i];                                \
+        uint16_t* resRow = res->array[i];                                     \
+        for(size_t j = 0; j < image->width; j++){                             \
+            resRow[j] = lut[row[j] & ((BINS)-1)];                             \
+        }                                                                     \
+    }                                                                         \
+}                                                                             \
+                                                                              \
+static uint64_t remapPixelsInPlace##BITS(PortableGrayMap* image,              \
+                                         const uint16_t* lut,                 \
+                                         const uint64_t* costs){              \
+    uint64_t error = 0;                                                       \
+    for(size_t i = 0; i < image->height; i++){                                \
+        uint16_t* row = image->array[i];                                      \
+        for(size_t j = 0; j < image->width; j++){                             \
+            const uint16_t pixel = row[j] & ((BINS)-1);                       \
+            error += costs[pixel];                                            \
+            row[j] = lut[pixel];                                              \
+        }                                                                     \
+    }                                                                         \
+    return error;                                                             \
+}
+
+DEFINE_KERNELS(8, BINS_8, LANES_8)
+DEFINE_KERNELS(16, BINS_16, 1)
+
+/*
+ * The rows of a view are stride bytes apart, whatever the size of a pixel.
+ */
+#define DEFINE_VIEW_COUNT(BITS, PIXEL, BINS, LANES)                           \
+static void countViewPixels##BITS(const GrayImageView* view,                  \
+                                  size_t* counters){                          \
+    const unsigned char* base = view->pixels;                                 \
+    for(size_t i = 0; i < view->height; i++){                                 \
+        const PIXEL* row = (const PIXEL*)(base + i*view->stride);             \
+        size_t j = 0;                                                         \
+        for(; j + (LANES) <= view->width; j += (LANES)){                      \
+            for(size_t l = 0; l < (LANES); l++){                              \
+                counters[l*(BINS) + (row[j+l] & ((BINS)-1))]++;               \
+            }                                                                 \
+        }                                                                     \
+        for(; j < view->width; j++){                                          \
+            counters[row[j] & ((BINS)-1)]++;                                  \
+        }                                                                     \
+    }                                                                         \
+}
+
+#define DEFINE_VIEW_REMAP(NAME, INPUT, OUTPUT, BINS)                          \
+static uint64_t remapViewPixels##NAME(const GrayImageView* view,              \
+                                      const uint16_t* lut,                    \
+                                      const uint64_t* costs,                  \
+                                      const GrayImageView* res){              \
+    const unsigned char* base = view->pixels;                                 \
+    unsigned char* resBase = res->pixels;                                     \
+    uint64_t error = 0;                                                       \
+    for(size_t i = 0; i < view->height; i++){                                 \
+        const INPUT* row = (const INPUT*)(base + i*view->stride);             \
+        OUTPUT* resRow = (OUTPUT*)(resBase + i*res->stride);                  \
+        for(size_t j = 0; j < view->width; j++){                              \
+            const INPUT pixel = row[j] & ((BINS)-1);                          \
+            error += costs[pixel];                                            \
+            resRow[j] = (OUTPUT)lut[pixel];                                   \
+        }                                                                     \
+    }                                                                         \
+    return error;                                                             \
+}
+
+DEFINE_VIEW_COUNT(8, uint8_t, BINS_8, LANES_8)
+DEFINE_VIEW_COUNT(16, uint16_t, BINS_16, 1)
+DEFINE_VIEW_REMAP(8To8, uint8_t, uint8_t, BINS_8)
+DEFINE_VIEW_REMAP(8To16, uint8_t, uint16_t, BINS_8)
+DEFINE_VIEW_REMAP(16To8, uint16_t, uint8_t, BINS_16)
+DEFINE_VIEW_REMAP(16To16, uint16_t, uint16_t, BINS_16)
+
+/* -------------------------------------------------------------------------- */
+
+static bool isValidView(const GrayImageView* view){
+    if(!view || (view->bitDepth != 8 && view->bitDepth != 16)){
+        return false;
+    }
+    const size_t pixelSize = view->bitDepth/8;
+    if(view->width == 0 || view->height == 0){
+        return true;
+    }
+    return view->pixels && view->stride >= view->width*pixelSize &&
+           view->stride % pixelSize == 0 &&
+           (view->bitDepth == 16 || view->maxValue < BINS_8);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void accumulateHistogram(const PortableGrayMap* image,
+                                size_t* histogram){
+    if(image->maxValue < BINS_8){
+        size_t counters[LANES_8*BINS_8] = {0};
+        countPixels8(image, counters);
+        for(size_t i = 0; i < BINS_8; i++){
+            for(size_t l = 0; l < LANES_8; l++){
+                histogram[i] += counters[l*BINS_8 + i];
+            }
+        }
+    }else{
+        countPixels16(image, histogram);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void createHistogram(const PortableGrayMap* image, size_t* histogram){
+    memset(histogram, 0, (image->maxValue < BINS_8 ? BINS_8 : BINS_16)*
+                         sizeof(size_t));
+    accumulateHistogram(image, histogram);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static double defineSamplingRate(size_t nPixels, size_t numLevels,
+                                 double rate){
+    if(rate < 0.0){
+        double nSamples = (double)SAMPLES_PER_SQUARED_LEVEL*numLevels*
+                          numLevels;
+        if(nSamples < MIN_SAMPLES){
+            nSamples = MIN_SAMPLES;
+        }
+        rate = nPixels > 0 ? nSamples/(double)nPixels : 1.0;
     }
-    
-    for (size_t i = 0; i < image->maxValue+1; i++){
-        histogram[i] = 0;
+    if(rate <= 0.0 || rate >= 1.0){
+        return 1.0;
     }
-    
-    for (size_t i = 0; i < image->height; i++){
-        for(size_t j = 0; j < image->width; j++){
-            histogram[image->array[i][j]]++;
+    return rate;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void createSampleLattice(size_t height, double rate,
+                                SampleLattice* lattice){
+    //Square-ish lattice of about 1/rate pixels per sample
+    const size_t stride = (size_t)(1.0/rate + 0.5);
+    size_t rowStep = 1;
+    while((rowStep + 1)*(rowStep + 1) <= stride && rowStep < height){
+        rowStep++;
+    }
+    size_t columnStep = (stride + rowStep/2)/rowStep;
+    if(columnStep == 0){
+        columnStep = 1;
+    }
+
+    //Fixed xorshift seed, so that the same image gives the same histogram
+    lattice->rowStep = rowStep;
+    lattice->columnStep = columnStep;
+    lattice->random = 0x9E3779B97F4A7C15u;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t sampleRow(SampleLattice* lattice, const uint16_t* row,
+                        size_t width, size_t bins, size_t* histogram){
+    lattice->random ^= lattice->random << 13;
+    lattice->random ^= lattice->random >> 7;
+    lattice->random ^= lattice->random << 17;
+    size_t nSamples = 0;
+    for(size_t j = lattice->random % lattice->columnStep; j < width;
+        j += lattice->columnStep){
+        histogram[row[j] & (bins-1)]++;
+        nSamples++;
+    }
+    return nSamples;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t createSampledHistogram(const PortableGrayMap* image,
+                                     size_t* histogram, double rate){
+    const bool eightBits = image->maxValue < BINS_8;
+    const size_t bins = eightBits ? BINS_8 : BINS_16;
+    memset(histogram, 0, bins*sizeof(size_t));
+
+    SampleLattice lattice;
+    createSampleLattice(image->height, rate, &lattice);
+    size_t nSamples = 0;
+    for(size_t i = lattice.rowStep/2; i < image->height;
+        i += lattice.rowStep){
+        nSamples += sampleRow(&lattice, image->array[i], image->width, bins,
+                              histogram);
+    }
+    return nSamples;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t fillHistogram(const PortableGrayMap* image, size_t numLevels,
+                            const ReductionSettings* settings,
+                            size_t* histogram){
+    const double rate = defineSamplingRate(image->width*image->height,
+                                           numLevels, settings->samplingRate);
+    if(rate < 1.0){
+        const size_t nSamples = createSampledHistogram(image, histogram, rate);
+        if(nSamples > 0){
+            return nSamples;
+        }
+    }
+    createHistogram(image, histogram);
+    return image->width*image->height;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void createLookupTable(const size_t* thresholds, const uint16_t* levels,
+                              size_t numLevels, size_t length, uint16_t* lut){
+    //Level k applies to the gray levels [p_{k-1}, p_k)
+    size_t i = 0;
+    for(size_t k = 0; k < numLevels; k++){
+        for(; i < thresholds[k] && i < length; i++){
+            lut[i] = levels[k];
         }
     }
-    return histogram;
+    for(; i < length; i++){
+        lut[i] = levels[numLevels-1];
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool defineLookupTable(const PortableGrayMap* image, size_t numLevels,
+                              const ReductionSettings* settings,
+                              uint16_t* levels, uint16_t* lut,
+                              ReductionReport* report){
+    //8-bit images only need a small histogram, kept on the stack
+    const bool eightBits = image->maxValue < BINS_8;
+    const size_t histogramLength = (size_t)image->maxValue + 1;
+    size_t smallHistogram[BINS_8];
+
+    //Dynamic memory allocation of different vectors
+    size_t* histogram = eightBits ? smallHistogram
+                                  : malloc(sizeof(size_t)*BINS_16);
+    size_t* thresholds = malloc(sizeof(size_t)*numLevels);
+    if(!histogram || !thresholds){
+        if(!eightBits){
+            free(histogram);
+        }
+        free(thresholds);
+        return false;
+    }
+
+    //The histogram may be estimated on a part of the pixels only
+    fillHistogram(image, numLevels, settings, histogram);
+
+    //Thresholds left undefined by the reduction cover the whole histogram
+    for(size_t k = 0; k < numLevels; k++){
+        thresholds[k] = histogramLength;
+    }
+
+    //Performs the reduction and make sure it works
+    const bool reduced = computeReductionWithSettings(histogram,
+                                                      histogramLength,
+                                                      numLevels, thresholds,
+                                                      levels, settings,
+                                                      report);
+    if(reduced){
+        createLookupTable(thresholds, levels, numLevels,
+                          eightBits ? BINS_8 : BINS_16, lut);
+    }
+
+    if(!eightBits){
+        free(histogram);
+    }
+    free(thresholds);
+    return reduced;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void createCostTable(const uint16_t* lut, size_t length,
+                            const ReductionSettings* settings,
+                            uint64_t* costs){
+    for(size_t i = 0; i < length; i++){
+        const uint64_t delta = i > lut[i] ? i - lut[i] : lut[i] - i;
+        costs[i] = settings->metric == ABSOLUTE_ERROR ? delta : delta*delta;
+        if(settings->weights && i < settings->weightsLength){
+            costs[i] *= settings->weights[i];
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool computeMappingError(const size_t* histogram, size_t length,
+                                const uint16_t* lut,
+                                const ReductionSettings* settings,
+                                uint64_t* error){
+    uint64_t* costs = malloc(sizeof(uint64_t)*length);
+    if(!costs){
+        return false;
+    }
+    createCostTable(lut, length, settings, costs);
+
+    *error = 0;
+    for(size_t i = 0; i < length; i++){
+        *error += (uint64_t)histogram[i]*costs[i];
+    }
+    free(costs);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t defineMaxValue(const uint16_t* levels, size_t numLevels){
+    return levels[numLevels-1] > 0 ? levels[numLevels-1] : 1;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void* countBatchPixels(void* arg){
+    BatchWorker* worker = arg;
+    for(size_t i = worker->first; i < worker->nImages; i += worker->step){
+        accumulateHistogram(worker->images[i], worker->histogram);
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void* remapBatchPixels(void* arg){
+    BatchWorker* worker = arg;
+    for(size_t i = worker->first; i < worker->nImages; i += worker->step){
+        PortableGrayMap* image = worker->images[i];
+        worker->errors[i] = image->maxValue < BINS_8
+                          ? remapPixelsInPlace8(image, worker->lut,
+                                                worker->costs)
+                          : remapPixelsInPlace16(image, worker->lut,
+                                                 worker->costs);
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void runWorkers(void* workers, size_t workerSize, size_t nWorkers,
+                       void* (*body)(void*)){
+    pthread_t* threads = malloc(nWorkers*sizeof(pthread_t));
+    bool* started = calloc(nWorkers, sizeof(bool));
+    unsigned char* worker = workers;
+
+    //Workers without a thread are run by the calling thread
+    for(size_t w = 1; w < nWorkers; w++){
+        if(threads && started){
+            started[w] = pthread_create(&threads[w], NULL, body,
+                                        worker + w*workerSize) == 0;
+        }
+    }
+    body(worker);
+    for(size_t w = 1; w < nWorkers; w++){
+        if(threads && started && started[w]){
+            pthread_join(threads[w], NULL);
+        }else{
+            body(worker + w*workerSize);
+        }
+    }
+
+    free(threads);
+    free(started);
 }
 
 /* -------------------------------------------------------------------------- */
 PortableGrayMap* quantizeGrayImage(const PortableGrayMap* image,
                                    size_t numLevels){
-    //Counter initialization
-    size_t k = 0;
-    
     if(!image || numLevels <= 0){
         return NULL;
     }
-    
+
+    //8-bit images only need a small lookup table, kept on the stack
+    const bool eightBits = image->maxValue < BINS_8;
+    uint16_t smallLut[BINS_8];
+
     //Create an image format able to receive the compression result
     PortableGrayMap* res = createEmptyImage(image->width, image->height,
                                             image->maxValue);
     if(!res){
         return NULL;
     }
-    
-    //Dynamic memory allocation of different vectors
-    size_t* histogram = createHistogram(image);
-    if(!histogram){
+
+    uint16_t* lut = eightBits ? smallLut : malloc(sizeof(uint16_t)*BINS_16);
+    uint16_t* levels = malloc(sizeof(uint16_t)*numLevels);
+    if(!lut || !levels ||
+       !defineLookupTable(image, numLevels, getDefaultReductionSettings(),
+                          levels, lut, NULL)){
         deleteImage(res);
+        if(!eightBits){
+            free(lut);
+        }
+        free(levels);
         return NULL;
     }
-    
-    size_t* thresholds = malloc(sizeof(size_t)*numLevels);
-    if(!thresholds){
-        deleteImage(res);
-        free(histogram);
+
+    //Image compression
+    if(eightBits){
+        remapPixels8(image, lut, res);
+    }else{
+        remapPixels16(image, lut, res);
+    }
+
+    //New definition of the max grey level
+    res->maxValue = defineMaxValue(levels, numLevels);
+
+    if(!eightBits){
+        free(lut);
+    }
+    free(levels);
+
+    return res;
+}
+
+/* -------------------------------------------------------------------------- */
+bool quantizeGrayImageInPlace(PortableGrayMap* image, size_t numLevels,
+                              const ReductionSettings* settings,
+                              uint16_t* levels, uint64_t* error,
+                              ReductionReport* report){
+    if(!image || numLevels <= 0){
+        return false;
+    }
+    if(!settings){
+        settings = getDefaultReductionSettings();
+    }
+
+    //8-bit images only need small tables, kept on the stack
+    const bool eightBits = image->maxValue < BINS_8;
+    uint16_t smallLut[BINS_8];
+    uint64_t smallCosts[BINS_8];
+
+    uint16_t* lut = eightBits ? smallLut : malloc(sizeof(uint16_t)*BINS_16);
+    uint64_t* costs = eightBits ? smallCosts
+                                : malloc(sizeof(uint64_t)*BINS_16);
+    uint16_t* newLevels = malloc(sizeof(uint16_t)*numLevels);
+    if(!lut || !costs || !newLevels ||
+       !defineLookupTable(image, numLevels, settings, newLevels, lut,
+                          report)){
+        if(!eightBits){
+            free(lut);
+            free(costs);
+        }
+        free(newLevels);
+        return false;
+    }
+
+    //Image compression, over the original pixels
+    createCostTable(lut, eightBits ? BINS_8 : BINS_16, settings, costs);
+    const uint64_t totalError = eightBits
+                              ? remapPixelsInPlace8(image, lut, costs)
+                              : remapPixelsInPlace16(image, lut, costs);
+
+    //New definition of the max grey level
+    image->maxValue = defineMaxValue(newLevels, numLevels);
+
+    if(levels){
+        memcpy(levels, newLevels, sizeof(uint16_t)*numLevels);
+    }
+    if(error){
+        *error = totalError;
+    }
+
+    if(!eightBits){
+        free(lut);
+        free(costs);
+    }
+    free(newLevels);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+GrayMapping* computeGrayMapping(const size_t* histogram,
+                                size_t histogramLength, size_t numLevels,
+                                const ReductionSettings* settings){
+    if(!histogram || histogramLength == 0 || histogramLength > BINS_16 ||
+       numLevels <= 0){
         return NULL;
     }
-    uint16_t* levels = malloc(sizeof(uint16_t)*numLevels);
-    if(!levels){
-        deleteImage(res);
-        free(histogram);
-        free(thresholds);
+    if(!settings){
+        settings = getDefaultReductionSettings();
+    }
+
+    GrayMapping* mapping = createEmptyMapping(histogramLength, numLevels);
+    if(!mapping){
         return NULL;
     }
-    
-    //Performs the reduction and make sure it works
-    if(!computeReduction(histogram, image->maxValue+1, numLevels, thresholds,
-                         levels)){
-        deleteImage(res);
+
+    //Thresholds left undefined by the reduction cover the whole histogram
+    for(size_t k = 0; k < numLevels; k++){
+        mapping->thresholds[k] = histogramLength;
+    }
+
+    if(!computeReductionWithSettings(histogram, histogramLength, numLevels,
+                                     mapping->thresholds, mapping->levels,
+                                     settings, NULL)){
+        deleteMapping(mapping);
+        return NULL;
+    }
+
+    createLookupTable(mapping->thresholds, mapping->levels, numLevels,
+                      histogramLength, mapping->lut);
+    if(!computeMappingError(histogram, histogramLength, mapping->lut,
+                            settings, &mapping->error)){
+        deleteMapping(mapping);
+        return NULL;
+    }
+    return mapping;
+}
+
+/* -------------------------------------------------------------------------- */
+GrayMapping* computeImageMapping(const PortableGrayMap* image,
+                                 size_t numLevels,
+                                 const ReductionSettings* settings){
+    if(!image || numLevels <= 0){
+        return NULL;
+    }
+    if(!settings){
+        settings = getDefaultReductionSettings();
+    }
+
+    //8-bit images only need a small histogram, kept on the stack
+    const bool eightBits = image->maxValue < BINS_8;
+    size_t smallHistogram[BINS_8];
+    size_t* histogram = eightBits ? smallHistogram
+                                  : malloc(sizeof(size_t)*BINS_16);
+    if(!histogram){
+        return NULL;
+    }
+
+    const size_t nCounted = fillHistogram(image, numLevels, settings,
+                                          histogram);
+    GrayMapping* mapping = computeGrayMapping(histogram,
+                                              (size_t)image->maxValue + 1,
+                                              numLevels, settings);
+
+    //The error of a sampled histogram is measured again on all the pixels
+    if(mapping && nCounted < image->width*image->height){
+        createHistogram(image, histogram);
+        if(!computeMappingError(histogram, (size_t)image->maxValue + 1,
+                                mapping->lut, settings, &mapping->error)){
+            deleteMapping(mapping);
+            mapping = NULL;
+        }
+    }
+
+    if(!eightBits){
         free(histogram);
-        free(thresholds);
-        free(levels);
+    }
+    return mapping;
+}
+
+/* -------------------------------------------------------------------------- */
+GrayMapping* computeStreamMapping(FILE* file, int kind, size_t numLevels,
+                                  const ReductionSettings* settings){
+    if(!file || numLevels <= 0){
         return NULL;
     }
-    
-    //Image compression
-    for (size_t i = 0; i < res->height; i++){
-        for(size_t j = 0; j < res->width; j++){
-            
-            //Search of the pixel value place in the threshold vector
-            while((k < numLevels) && (image->array[i][j] > thresholds[k])){
-                k++;
+    if(!settings){
+        settings = getDefaultReductionSettings();
+    }
+
+    PortableGrayMap header;
+    if(readImageHeader(file, kind, &header) != 0){
+        return NULL;
+    }
+    const size_t histogramLength = (size_t)header.maxValue + 1;
+    const size_t bins = header.maxValue < BINS_8 ? BINS_8 : BINS_16;
+    const double rate = defineSamplingRate(header.width*header.height,
+                                           numLevels, settings->samplingRate);
+
+    //The histograms of all the pixels and of the sampled ones are counted
+    //while the rows are read, a single row being held at a time
+    size_t* histogram = calloc(bins, sizeof(size_t));
+    size_t* sampled = rate < 1.0 ? calloc(bins, sizeof(size_t)) : NULL;
+    uint16_t* row = malloc(sizeof(uint16_t)*header.width);
+    bool read = histogram && (rate >= 1.0 || sampled) &&
+                (row || header.width == 0);
+
+    SampleLattice lattice;
+    createSampleLattice(header.height, rate, &lattice);
+    size_t nSamples = 0;
+    for(size_t i = 0; read && i < header.height; i++){
+        read = readImageRow(file, &header, row) == 0;
+        for(size_t j = 0; read && j < header.width; j++){
+            histogram[row[j]]++;
+        }
+        if(read && sampled && i % lattice.rowStep == lattice.rowStep/2){
+            nSamples += sampleRow(&lattice, row, header.width, bins, sampled);
+        }
+    }
+
+    //As for an image, the error of a sampled reduction is measured again
+    GrayMapping* mapping = NULL;
+    if(read){
+        mapping = computeGrayMapping(nSamples > 0 ? sampled : histogram,
+                                     histogramLength, numLevels, settings);
+    }
+    if(mapping && nSamples > 0 &&
+       !computeMappingError(histogram, histogramLength, mapping->lut,
+                            settings, &mapping->error)){
+        deleteMapping(mapping);
+        mapping = NULL;
+    }
+
+    free(row);
+    free(sampled);
+    free(histogram);
+    return mapping;
+}
+
+/* -------------------------------------------------------------------------- */
+bool quantizeGrayImagesShared(PortableGrayMap** images, size_t nImages,
+                              size_t numLevels,
+                              const ReductionSettings* settings,
+                              uint16_t* levels, uint64_t* errors,
+                              ReductionReport* report){
+    if(!images || nImages <= 0 || numLevels <= 0){
+        return false;
+    }
+    if(!settings){
+        settings = getDefaultReductionSettings();
+    }
+
+    //The shared levels cover the gray levels of every image
+    uint16_t maxValue = 0;
+    for(size_t i = 0; i < nImages; i++){
+        if(!images[i]){
+            return false;
+        }
+        if(images[i]->maxValue > maxValue){
+            maxValue = images[i]->maxValue;
+        }
+    }
+    const size_t bins = maxValue < BINS_8 ? BINS_8 : BINS_16;
+    const size_t histogramLength = (size_t)maxValue + 1;
+
+    //One thread per core, as long as each has an image
+    long nCores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nWorkers = nCores > 1 ? (size_t)nCores : 1;
+    if(nWorkers > nImages){
+        nWorkers = nImages;
+    }
+
+    //Dynamic memory allocation of different vectors
+    BatchWorker* workers = malloc(sizeof(BatchWorker)*nWorkers);
+    size_t* histograms = calloc(nWorkers*bins, sizeof(size_t));
+    uint16_t* lut = malloc(sizeof(uint16_t)*bins);
+    uint64_t* costs = malloc(sizeof(uint64_t)*bins);
+    size_t* thresholds = malloc(sizeof(size_t)*numLevels);
+    uint16_t* newLevels = malloc(sizeof(uint16_t)*numLevels);
+    uint64_t* newErrors = malloc(sizeof(uint64_t)*nImages);
+    bool reduced = false;
+    if(workers && histograms && lut && costs && thresholds && newLevels &&
+       newErrors){
+        //Histograms of the images, counted in parallel, then merged
+        for(size_t w = 0; w < nWorkers; w++){
+            workers[w] = (BatchWorker){images, nImages, w, nWorkers,
+                                       histograms + w*bins, lut, costs,
+                                       newErrors};
+        }
+        runWorkers(workers, sizeof(BatchWorker), nWorkers, countBatchPixels);
+        for(size_t w = 1; w < nWorkers; w++){
+            for(size_t i = 0; i < bins; i++){
+                histograms[i] += histograms[w*bins + i];
             }
-            res->array[i][j] = levels[k];
-            //Counter reset
-            k = 0;
         }
+
+        //A single reduction, on the merged histogram
+        for(size_t k = 0; k < numLevels; k++){
+            thresholds[k] = histogramLength;
+        }
+        reduced = computeReductionWithSettings(histograms, histogramLength,
+                                               numLevels, thresholds,
+                                               newLevels, settings, report);
     }
-    
-    //New definition of the max grey level
-    res->maxValue = levels[numLevels-1];
-    
+
+    if(reduced){
+        createLookupTable(thresholds, newLevels, numLevels, bins, lut);
+        createCostTable(lut, bins, settings, costs);
+
+        //Image compression, in parallel, with the shared lookup table
+        runWorkers(workers, sizeof(BatchWorker), nWorkers, remapBatchPixels);
+        for(size_t i = 0; i < nImages; i++){
+            images[i]->maxValue = defineMaxValue(newLevels,
+                                                 numLevels);
+        }
+
+        if(levels){
+            memcpy(levels, newLevels, sizeof(uint16_t)*numLevels);
+        }
+        if(errors){
+            memcpy(errors, newErrors, sizeof(uint64_t)*nImages);
+        }
+    }
+
+    free(workers);
+    free(histograms);
+    free(lut);
+    free(costs);
     free(thresholds);
-    free(levels);
-    free(histogram);
-    
-    return res;
+    free(newLevels);
+    free(newErrors);
+    return reduced;
+}
+
+/* -------------------------------------------------------------------------- */
+bool quantizeGrayView(const GrayImageView* input, GrayImageView* output,
+                      size_t numLevels, const ReductionSettings* settings,
+                      uint16_t* levels, uint64_t* error){
+    if(!isValidView(input) || !isValidView(output) || numLevels <= 0 ||
+       output->width != input->width || output->height != input->height){
+        return false;
+    }
+    if(!settings){
+        settings = getDefaultReductionSettings();
+    }
+
+    //8-bit pixels only need small tables, kept on the stack
+    const bool eightBits = input->bitDepth == 8;
+    const size_t bins = eightBits ? BINS_8 : BINS_16;
+    const size_t histogramLength = (size_t)input->maxValue + 1;
+    size_t counters[LANES_8*BINS_8] = {0};
+    uint16_t smallLut[BINS_8];
+    uint64_t smallCosts[BINS_8];
+
+    //Dynamic memory allocation of different vectors
+    size_t* histogram = eightBits ? counters : calloc(BINS_16, sizeof(size_t));
+    uint16_t* lut = eightBits ? smallLut : malloc(sizeof(uint16_t)*BINS_16);
+    uint64_t* costs = eightBits ? smallCosts
+                                : malloc(sizeof(uint64_t)*BINS_16);
+    size_t* thresholds = malloc(sizeof(size_t)*numLevels);
+    uint16_t* newLevels = malloc(sizeof(uint16_t)*numLevels);
+    bool reduced = false;
+    if(histogram && lut && costs && thresholds && newLevels){
+        //Histogram counted on the pixels of the caller
+        if(eightBits){
+            countViewPixels8(input, counters);
+            for(size_t i = 0; i < BINS_8; i++){
+                for(size_t l = 1; l < LANES_8; l++){
+                    counters[i] += counters[l*BINS_8 + i];
+                }
+            }
+        }else{
+            countViewPixels16(input, histogram);
+        }
+
+        //Thresholds left undefined by the reduction cover the whole histogram
+        for(size_t k = 0; k < numLevels; k++){
+            thresholds[k] = histogramLength;
+        }
+        reduced = computeReductionWithSettings(histogram, histogramLength,
+                                               numLevels, thresholds,
+                                               newLevels, settings, NULL) &&
+                  (output->bitDepth == 16 ||
+                   newLevels[numLevels-1] < BINS_8);
+    }
+
+    if(reduced){
+        createLookupTable(thresholds, newLevels, numLevels, bins, lut);
+        createCostTable(lut, bins, settings, costs);
+
+        //Compression, from the pixels of the caller to its buffer
+        uint64_t totalError = 0;
+        if(eightBits){
+            totalError = output->bitDepth == 8
+                       ? remapViewPixels8To8(input, lut, costs, output)
+                       : remapViewPixels8To16(input, lut, costs, output);
+        }else{
+            totalError = output->bitDepth == 8
+                       ? remapViewPixels16To8(input, lut, costs, output)
+                       : remapViewPixels16To16(input, lut, costs, output);
+        }
+        output->maxValue = defineMaxValue(newLevels, numLevels);
+
+        if(levels){
+            memcpy(levels, newLevels, sizeof(uint16_t)*numLevels);
+        }
+        if(error){
+            *error = totalError;
+        }
+    }
+
+    if(!eightBits){
+        free(histogram);
+        free(lut);
+        free(costs);
+    }
+    free(thresholds);
+    free(newLevels);
+    return reduced;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool isValidWideView(const WideImageView* view){
+    if(!view || (view->format != SAMPLE_UINT32 &&
+                 view->format != SAMPLE_FLOAT32)){
+        return false;
+    }
+    if(view->width == 0 || view->height == 0){
+        return true;
+    }
+    return view->pixels && view->stride >= view->width*4 &&
+           view->stride % 4 == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static inline double readWideSample(const WideImageView* view,
+                                    const unsigned char* row, size_t j){
+    if(view->format == SAMPLE_UINT32){
+        return ((const uint32_t*)row)[j];
+    }
+    return ((const float*)row)[j];
+}
+
+/* -------------------------------------------------------------------------- */
+
+static inline void writeWideSample(const WideImageView* view,
+                                   unsigned char* row, size_t j,
+                                   double value){
+    if(view->format == SAMPLE_UINT32){
+        ((uint32_t*)row)[j] = (uint32_t)value;
+    }else{
+        ((float*)row)[j] = (float)value;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static inline size_t defineWideBin(const WideWorker* worker, double value){
+    const double position = (value - worker->offset)*worker->scale;
+    const size_t bin = position > 0.0 ? (size_t)position : 0;
+    return bin < worker->nBins ? bin : worker->nBins - 1;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void* scanWideRows(void* arg){
+    WideWorker* worker = arg;
+    const WideImageView* view = worker->view;
+    const unsigned char* base = view->pixels;
+    worker->lowest = INFINITY;
+    worker->highest = -INFINITY;
+    worker->finite = true;
+    for(size_t i = worker->firstRow; i < worker->lastRow; i++){
+        const unsigned char* row = base + i*view->stride;
+        for(size_t j = 0; j < view->width; j++){
+            const double value = readWideSample(view, row, j);
+            worker->finite &= isfinite(value) != 0;
+            worker->lowest = value < worker->lowest ? value : worker->lowest;
+            worker->highest = value > worker->highest ? value
+                                                      : worker->highest;
+        }
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void* countWideRows(void* arg){
+    WideWorker* worker = arg;
+    const WideImageView* view = worker->view;
+    const unsigned char* base = view->pixels;
+    for(size_t i = worker->firstRow; i < worker->lastRow; i++){
+        const unsigned char* row = base + i*view->stride;
+        for(size_t j = 0; j < view->width; j++){
+            const double value = readWideSample(view, row, j);
+            const size_t bin = defineWideBin(worker, value);
+            worker->histogram[bin]++;
+            worker->sums[bin] += value;
+        }
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void* remapWideRows(void* arg){
+    WideWorker* worker = arg;
+    const WideImageView* view = worker->view;
+    const unsigned char* base = view->pixels;
+    unsigned char* resBase = worker->res->pixels;
+    worker->error = 0.0;
+    for(size_t i = worker->firstRow; i < worker->lastRow; i++){
+        const unsigned char* row = base + i*view->stride;
+        unsigned char* resRow = resBase + i*worker->res->stride;
+        for(size_t j = 0; j < view->width; j++){
+            const double value = readWideSample(view, row, j);
+            const size_t bin = defineWideBin(worker, value);
+
+            //First level whose threshold exceeds the bin
+            size_t lower = 0, upper = worker->numLevels - 1;
+            while(lower < upper){
+                size_t middle = lower + (upper - lower)/2;
+                if(worker->thresholds[middle] > bin){
+                    upper = middle;
+                }else{
+                    lower = middle + 1;
+                }
+            }
+
+            const double level = worker->levels[lower];
+            const double delta = fabs(value - level);
+            double cost = worker->metric == ABSOLUTE_ERROR ? delta
+                                                           : delta*delta;
+            if(worker->weights && bin < worker->weightsLength){
+                cost *= (double)worker->weights[bin];
+            }
+            worker->error += cost;
+            writeWideSample(worker->res, resRow, j, level);
+        }
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+bool quantizeWideView(const WideImageView* input, WideImageView* output,
+                      size_t numLevels, const ReductionSettings* settings,
+                      double* levels, double* error){
+    if(!isValidWideView(input) || !isValidWideView(output) ||
+       numLevels <= 0 || output->format != input->format ||
+       output->width != input->width || output->height != input->height){
+        return false;
+    }
+    if(!settings){
+        settings = getDefaultReductionSettings();
+    }
+
+    //One thread per core, as long as each has a row
+    long nCores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nWorkers = nCores > 1 ? (size_t)nCores : 1;
+    if(nWorkers > input->height){
+        nWorkers = input->height > 0 ? input->height : 1;
+    }
+    const size_t nRows = (input->height + nWorkers - 1)/nWorkers;
+
+    WideWorker* workers = calloc(nWorkers, sizeof(WideWorker));
+    if(!workers){
+        return false;
+    }
+    for(size_t w = 0; w < nWorkers; w++){
+        workers[w].view = input;
+        workers[w].res = output;
+        workers[w].firstRow = w*nRows < input->height ? w*nRows
+                                                      : input->height;
+        workers[w].lastRow = (w + 1)*nRows < input->height ? (w + 1)*nRows
+                                                           : input->height;
+        workers[w].metric = settings->metric;
+        workers[w].weights = settings->weights;
+        workers[w].weightsLength = settings->weightsLength;
+    }
+
+    //Range of the samples, found in parallel
+    runWorkers(workers, sizeof(WideWorker), nWorkers, scanWideRows);
+    double lowest = INFINITY, highest = -INFINITY;
+    bool finite = true;
+    for(size_t w = 0; w < nWorkers; w++){
+        finite &= workers[w].finite;
+        lowest = workers[w].lowest < lowest ? workers[w].lowest : lowest;
+        highest = workers[w].highest > highest ? workers[w].highest : highest;
+    }
+    if(!finite){
+        free(workers);
+        return false;
+    }
+    if(lowest > highest){
+        lowest = highest = 0.0;
+    }
+
+    //Bins of width 1 for integers of a small range, evenly spread otherwise
+    const double span = highest - lowest;
+    const bool unitBins = input->format == SAMPLE_UINT32 && span < WIDE_BINS;
+    const size_t nBins = unitBins ? (size_t)span + 1
+                                  : (span > 0.0 ? WIDE_BINS : 1);
+    const double scale = unitBins ? 1.0 : (span > 0.0 ? nBins/span : 0.0);
+
+    //Dynamic memory allocation of different vectors
+    size_t* histograms = calloc(nWorkers*nBins, sizeof(size_t));
+    double* sums = calloc(nWorkers*nBins, sizeof(double));
+    size_t* thresholds = malloc(sizeof(size_t)*numLevels);
+    uint16_t* binLevels = malloc(sizeof(uint16_t)*numLevels);
+    double* newLevels = malloc(sizeof(double)*numLevels);
+    bool reduced = false;
+    if(histograms && sums && thresholds && binLevels && newLevels){
+        //Histogram of the bins, counted in parallel, then merged
+        for(size_t w = 0; w < nWorkers; w++){
+            workers[w].offset = lowest;
+            workers[w].scale = scale;
+            workers[w].nBins = nBins;
+            workers[w].histogram = histograms + w*nBins;
+            workers[w].sums = sums + w*nBins;
+            workers[w].thresholds = thresholds;
+            workers[w].levels = newLevels;
+            workers[w].numLevels = numLevels;
+        }
+        runWorkers(workers, sizeof(WideWorker), nWorkers, countWideRows);
+        for(size_t w = 1; w < nWorkers; w++){
+            for(size_t b = 0; b < nBins; b++){
+                histograms[b] += histograms[w*nBins + b];
+                sums[b] += sums[w*nBins + b];
+            }
+        }
+
+        //Thresholds left undefined by the reduction cover the whole histogram
+        for(size_t k = 0; k < numLevels; k++){
+            thresholds[k] = nBins;
+        }
+        reduced = computeReductionWithSettings(histograms, nBins, numLevels,
+                                               thresholds, binLevels,
+                                               settings, NULL);
+    }
+
+    if(reduced){
+        //Levels of the samples themselves, representable in their format
+        for(size_t k = 0; k < numLevels; k++){
+            double count = 0.0, sum = 0.0;
+            for(size_t b = k > 0 ? thresholds[k-1] : 0; b < thresholds[k] &&
+                b < nBins; b++){
+                //The weighted mean minimizes the weighted squared error
+                const double weight = settings->weights &&
+                                      b < settings->weightsLength
+                                    ? (double)settings->weights[b] : 1.0;
+                count += weight*histograms[b];
+                sum += weight*sums[b];
+            }
+            double level = unitBins ? lowest + binLevels[k]
+                                    : (scale > 0.0
+                                       ? lowest + (binLevels[k] + 0.5)/scale
+                                       : lowest);
+            if(settings->metric == SQUARED_ERROR && count > 0.0){
+                level = sum/count;
+            }
+            if(input->format == SAMPLE_UINT32){
+                level = level < 0.0 ? 0.0 : (level > UINT32_MAX ? UINT32_MAX
+                                                                : level);
+                level = (double)(uint64_t)(level + 0.5);
+            }else{
+                level = (float)level;
+            }
+            newLevels[k] = level;
+        }
+
+        //Compression, in parallel, by a binary search of the thresholds
+        runWorkers(workers, sizeof(WideWorker), nWorkers, remapWideRows);
+        double totalError = 0.0;
+        for(size_t w = 0; w < nWorkers; w++){
+            totalError += workers[w].error;
+        }
+
+        if(levels){
+            memcpy(levels, newLevels, sizeof(double)*numLevels);
+        }
+        if(error){
+            *error = totalError;
+        }
+    }
+
+    free(workers);
+    free(histograms);
+    free(sums);
+    free(thresholds);
+    free(binLevels);
+    free(newLevels);
+    return reduced;
 }
@@ -6,13 +6,50 @@
 #ifndef _IMAGE_QUANTIZER_H_
 #define _IMAGE_QUANTIZER_H_
 
+#include <stdbool.h>
+
 #include "PortableGrayMap.h"
+#include "GrayMapping.h"
+#include "ReductionSettings.h"
+
+/* Types */
+
+/* Gray pixels owned by the caller, stored row after row */
+typedef struct
+{
+  void* pixels;                 // First pixel of the first row
+  size_t width;                 // Number of pixels of a row
+  size_t height;                // Number of rows
+  size_t stride;                // Number of bytes from a row to the next one
+  unsigned bitDepth;            // 8 (uint8_t pixels) or 16 (uint16_t pixels)
+  uint16_t maxValue;            // Maximum gray value
+} GrayImageView;
+
+/* Format of the samples of a wide view */
+typedef enum
+{
+  SAMPLE_UINT32,
+  SAMPLE_FLOAT32
+} SampleFormat;
 
+/* Samples owned by the caller too wide for a gray level, stored row
+   after row */
+typedef struct
+{
+  void* pixels;                 // First sample of the first row
+  size_t width;                 // Number of samples of a row
+  size_t height;                // Number of rows
+  size_t stride;                // Number of bytes from a row to the next one
+  SampleFormat format;          // uint32_t or float samples
+} WideImageView;
+
+/* Functions */
 
 /***********************************************************************
  * Quantize an image I in k levels of gray such that the quantized
  * image I* minimizes the squared error.
  * \sum_{i = 1}^height \sum_{j = 1}^width (I[i,j] - I*[i,j])^2
+ * with the default settings of ReductionSettings.h.
  *
  * This function does not affect the original image.
  *
@@ -27,6 +64,200 @@
 PortableGrayMap* quantizeGrayImage(const PortableGrayMap* image,
                                    size_t numLevels);
 
+/***********************************************************************
+ * Quantize an image I in k levels of gray as quantizeGrayImage does,
+ * but overwrite the pixels of I with those of I* instead of allocating
+ * a second raster. The reduction follows the given settings, which
+ * may replace the squared error by another metric or weights, or build
+ * the histogram on a sample of the pixels. The error, measured as by
+ * the reduction, is accumulated while remapping, so that it is exact
+ * even if the histogram is sampled.
+ *
+ * PARAMETERS
+ * image            - The image to quantize (with n levels), receiving
+ *                    the quantized image in k levels
+ * numLevels        - The new number of gray levels (0 < k <= n)
+ * settings         - The tuning parameters of the reduction (NULL for
+ *                    the defaults)
+ * levels           - A vector of size k where the levels are stored
+ *                    (NULL if not needed)
+ * error            - A pointer where the error is stored
+ *                    (NULL if not needed)
+ * report           - A pointer where the report of the reduction is
+ *                    stored (NULL if not needed)
+ *
+ * RETURN
+ * true             - if the image was quantized
+ * false            - if any error, the image being left untouched
+ ***********************************************************************/
+bool quantizeGrayImageInPlace(PortableGrayMap* image, size_t numLevels,
+                              const ReductionSettings* settings,
+                              uint16_t* levels, uint64_t* error,
+                              ReductionReport* report);
+
+/***********************************************************************
+ * Compute the mapping function g quantizing a histogram h of n gray
+ * levels in k levels, without any image, along with its error
+ * \sum_{i=0}^{n-1} w[i]h[i]d(i, g(i)) (see ReductionSettings.h).
+ * The mapping must later be deleted by calling deleteMapping().
+ *
+ * PARAMETERS
+ * histogram        - The histogram vector (h)
+ * histogramLength  - Size of the histogram vector (n)
+ * numLevels        - The number of levels (0 < k <= n)
+ * settings         - The tuning parameters of the reduction (NULL for
+ *                    the defaults)
+ *
+ * RETURN
+ * NULL             - if any error
+ * mapping          - The mapping of the n gray levels on k levels
+ ***********************************************************************/
+GrayMapping* computeGrayMapping(const size_t* histogram,
+                                size_t histogramLength, size_t numLevels,
+                                const ReductionSettings* settings);
+
+/***********************************************************************
+ * Compute the mapping function g that quantizeGrayImageInPlace would
+ * apply to an image, without remapping its pixels. Even if the
+ * histogram of the reduction is sampled, the error is computed on all
+ * the pixels.
+ * The mapping must later be deleted by calling deleteMapping().
+ *
+ * PARAMETERS
+ * image            - The image to treat (with n = maxValue + 1 levels)
+ * numLevels        - The number of levels (0 < k <= n)
+ * settings         - The tuning parameters of the reduction (NULL for
+ *                    the defaults)
+ *
+ * RETURN
+ * NULL             - if any error
+ * mapping          - The mapping of the n gray levels on k levels
+ ***********************************************************************/
+GrayMapping* computeImageMapping(const PortableGrayMap* image,
+                                 size_t numLevels,
+                                 const ReductionSettings* settings);
+
+/***********************************************************************
+ * Compute the same mapping as computeImageMapping for the next PGM image
+ * of a stream, whose rows are counted as they are read instead of being
+ * loaded first, so that only one of them is held at a time.
+ * The mapping must later be deleted by calling deleteMapping().
+ *
+ * PARAMETERS
+ * file             - A stream positioned just after a magic number
+ * kind             - The kind returned by readMagicNumber()
+ * numLevels        - The number of levels (0 < k <= n)
+ * settings         - The tuning parameters of the reduction (NULL for
+ *                    the defaults)
+ *
+ * RETURN
+ * NULL             - if any error, including an image other than PGM
+ * mapping          - The mapping of the n gray levels on k levels
+ ***********************************************************************/
+GrayMapping* computeStreamMapping(FILE* file, int kind, size_t numLevels,
+                                  const ReductionSettings* settings);
+
+/***********************************************************************
+ * Quantize a batch of images I_1, ..., I_N in place on the same k levels
+ * of gray: the mapping function g minimizes the error summed over all
+ * the images, that is the error on the sum of their histograms. The
+ * histograms are counted, and the images remapped, on several threads,
+ * while the reduction runs only once. Every pixel is counted, whatever
+ * the sampling rate of the settings.
+ *
+ * PARAMETERS
+ * images           - The N images to quantize (with at most n levels),
+ *                    receiving the quantized images
+ * nImages          - The number of images (N > 0)
+ * numLevels        - The new number of gray levels (0 < k <= n)
+ * settings         - The tuning parameters of the reduction (NULL for
+ *                    the defaults)
+ * levels           - A vector of size k where the shared levels are
+ *                    stored (NULL if not needed)
+ * errors           - A vector of size N where the error of each image
+ *                    is stored (NULL if not needed)
+ * report           - A pointer where the report of the reduction is
+ *                    stored (NULL if not needed)
+ *
+ * RETURN
+ * true             - if the images were quantized
+ * false            - if any error, the images being left untouched
+ ***********************************************************************/
+bool quantizeGrayImagesShared(PortableGrayMap** images, size_t nImages,
+                              size_t numLevels,
+                              const ReductionSettings* settings,
+                              uint16_t* levels, uint64_t* errors,
+                              ReductionReport* report);
+
+/***********************************************************************
+ * Quantize pixels owned by the caller in k levels of gray as
+ * quantizeGrayImageInPlace does, without any intermediate image: the
+ * histogram is counted, and the pixels remapped, directly on the
+ * buffers. Every pixel is counted, whatever the sampling rate of the
+ * settings.
+ *
+ * The output may be the input itself, or another buffer of the same
+ * size, not overlapping it, of either bit depth; an 8-bit output
+ * requires levels below 256.
+ *
+ * PARAMETERS
+ * input            - The pixels to quantize (with n = maxValue + 1
+ *                    levels, an 8-bit input having maxValue < 256)
+ * output           - The buffer receiving the quantized pixels, whose
+ *                    maxValue is set to the last level
+ * numLevels        - The new number of gray levels (0 < k <= n)
+ * settings         - The tuning parameters of the reduction (NULL for
+ *                    the defaults)
+ * levels           - A vector of size k where the levels are stored
+ *                    (NULL if not needed)
+ * error            - A pointer where the error is stored
+ *                    (NULL if not needed)
+ *
+ * RETURN
+ * true             - if the pixels were quantized
+ * false            - if any error, the output being left untouched
+ ***********************************************************************/
+bool quantizeGrayView(const GrayImageView* input, GrayImageView* output,
+                      size_t numLevels, const ReductionSettings* settings,
+                      uint16_t* levels, uint64_t* error);
+
+/***********************************************************************
+ * Quantize 32-bit integer or floating-point samples owned by the caller
+ * in k levels, whatever their range. Their values are first gathered
+ * in at most 4096 bins, of width 1 for integers of a small enough range
+ * and spread evenly over the range of the samples otherwise, on
+ * several threads. The reduction runs on the histogram of the bins,
+ * and each sample is then remapped by a binary search of its bin in
+ * the k thresholds. The weights of the settings apply to the bins.
+ *
+ * A level is the mean of the samples it replaces, weighted by the
+ * weights of their bins (squared error), rounded to the nearest integer
+ * for integer samples. The error is measured on the samples themselves.
+ * Under the absolute error, a level is only the center of the bin of
+ * the (weighted) median, not a median of the samples, so that it is not
+ * the best level when the bins are wider than 1.
+ *
+ * PARAMETERS
+ * input            - The samples to quantize, all finite
+ * output           - The buffer receiving the quantized samples, of the
+ *                    same size and format as input; it may be input
+ *                    itself, or another buffer not overlapping it
+ * numLevels        - The new number of levels (k > 0)
+ * settings         - The tuning parameters of the reduction (NULL for
+ *                    the defaults)
+ * levels           - A vector of size k where the levels are stored
+ *                    (NULL if not needed)
+ * error            - A pointer where the error is stored
+ *                    (NULL if not needed)
+ *
+ * RETURN
+ * true             - if the samples were quantized
+ * false            - if any error, the output being left untouched
+ ***********************************************************************/
+bool quantizeWideView(const WideImageView* input, WideImageView* output,
+                      size_t numLevels, const ReductionSettings* settings,
+                      double* levels, double* error);
+
 
 #endif // !_IMAGE_QUANTIZER_H_
 
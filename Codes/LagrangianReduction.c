@@ -0,0 +1,375 @@
+/* ========================================================================== *
+ * LagrangianReduction                                                        *
+ * Relax the number of levels with a penalty per level, whose cost does not   *
+ * depend on the number of levels                                             *
+ * ========================================================================== */
+
+/* ========================================================================== *
+ *                                  HEADER                                    *
+ * ========================================================================== */
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "Reduction.h"
+#include "ReductionSettings.h"
+#include "ReductionMoments.h"
+
+/*
+ * Let E(k) be the optimal error with k levels. The interval errors satisfy the
+ * quadrangle inequality, so E is convex and, for a penalty L per level, the
+ * best partition of the histogram for E(k) + kL (the penalized problem) has
+ * fewer levels as L grows. The errors being integers, some integer L makes k
+ * one of the optimal numbers of levels of the penalized problem, and a
+ * partition of the histogram in k levels optimal for it is optimal for E(k).
+ */
+
+/* ========================================================================== *
+ *                                   TYPES                                    *
+ * ========================================================================== */
+
+/* Data of the penalized problem */
+typedef struct {
+    const uint64_t* count;      // Prefix moments of the histogram
+    const uint64_t* sum;
+    const uint64_t* squares;
+    size_t length;              // Number of bins of the histogram
+    ErrorMetric metric;         // Error of the intervals
+
+    int64_t* errors;            // Best penalized error of [0, j), size n+1
+    uint32_t* nLevels;          // Number of levels of this best partition
+    uint32_t* splits;           // Beginning of its last level
+    uint32_t* candidates;       // Queue of the splits that may still be best
+    uint32_t* starts;           // First end for which each one is the best
+} PenalizedProblem;
+
+/* ========================================================================== *
+ *                                 PROTOTYPES                                 *
+ * ========================================================================== */
+
+/* -------------------------------------------------------------------------- *
+ * Define the minimal error made by the replacement of the gray levels [i, j) *
+ * by a single level, for the error metric of the penalized problem           *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * problem          A valid pointer to the penalized problem                  *
+ * i                The beginning of the sub-histogram                        *
+ * j                The end (excluded) of the sub-histogram to treat (i < j)  *
+ * level            A pointer to a value who will contain the best level, or  *
+ *                  NULL                                                      *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * errorMin         The minimal error commited                                *
+ * -------------------------------------------------------------------------- */
+static inline int64_t defineLevelError(const PenalizedProblem* problem,
+                                       size_t i, size_t j, uint16_t* level);
+
+/* -------------------------------------------------------------------------- *
+ * Tell whether the partition of [0, end) whose last level begins at a split  *
+ * is better than the one whose last level begins at an earlier split. Equal  *
+ * errors are told apart by the number of levels.                             *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * problem          A valid pointer to the penalized problem                  *
+ * split            The later split                                           *
+ * earlier          The earlier split (< split)                               *
+ * end              The end of the partition (> split)                        *
+ * fewest           Whether fewer levels are better, or more levels           *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If the later split is better                              *
+ * false            Else                                                      *
+ * -------------------------------------------------------------------------- */
+static inline bool isBetterSplit(const PenalizedProblem* problem, size_t split,
+                                 size_t earlier, size_t end, bool fewest);
+
+/* -------------------------------------------------------------------------- *
+ * Solve the penalized problem in O(n log n): by the quadrangle inequality,   *
+ * once a later split is better than an earlier one for some end, it stays    *
+ * better for the larger ends, so that the splits still worth considering     *
+ * form a queue, each one being the best on an interval of ends found by a    *
+ * binary search                                                              *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * problem          A valid pointer to the penalized problem                  *
+ * penalty          The penalty of a level (L >= 0)                           *
+ * fewest           Whether the best partition with the fewest levels is      *
+ *                  wished, or the one with the most levels                   *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * nLevels          The number of levels of the best partition                *
+ * -------------------------------------------------------------------------- */
+static size_t solvePenalized(PenalizedProblem* problem, int64_t penalty,
+                             bool fewest);
+
+/* -------------------------------------------------------------------------- *
+ * Extract the bounds 0 = b_0 < b_1 < ... < b_m = n of the levels of the last *
+ * partition found by solvePenalized                                          *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * problem          A valid pointer to the penalized problem                  *
+ * bounds           A vector of size m+1 who will contain the bounds          *
+ * -------------------------------------------------------------------------- */
+static void extractBounds(const PenalizedProblem* problem, size_t* bounds);
+
+/* -------------------------------------------------------------------------- *
+ * Splice two best partitions of the penalized problem, with p < k < q        *
+ * levels, in a best partition with k levels. A level [b_t, b_{t+1}) of the   *
+ * second one nested in a level [a_s, a_{s+1}) of the first one, with         *
+ * t - s = k - p, gives the partition b_0, ..., b_t, a_{s+1}, ..., a_p, which *
+ * is still optimal by the quadrangle inequality.                             *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * fewer            The bounds of the partition with p levels                 *
+ * nFewer           The number of levels p                                    *
+ * more             The bounds of the partition with q levels                 *
+ * nMore            The number of levels q                                    *
+ * nLevels          The number of levels wished k                             *
+ * bounds           A vector of size k+1 who will contain the bounds          *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If the partitions could be spliced                        *
+ * false            Else                                                      *
+ * -------------------------------------------------------------------------- */
+static bool spliceBounds(const size_t* fewer, size_t nFewer,
+                         const size_t* more, size_t nMore, size_t nLevels,
+                         size_t* bounds);
+
+/* ========================================================================== *
+ *                                  FUNCTIONS                                 *
+ * ========================================================================== */
+
+static inline int64_t defineLevelError(const PenalizedProblem* problem,
+                                       size_t i, size_t j, uint16_t* level){
+    return defineIntervalError(problem->metric, problem->count, problem->sum,
+                               problem->squares, i, j, level);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static inline bool isBetterSplit(const PenalizedProblem* problem, size_t split,
+                                 size_t earlier, size_t end, bool fewest){
+    const int64_t error = problem->errors[split] +
+                          defineLevelError(problem, split, end, NULL);
+    const int64_t earlierError = problem->errors[earlier] +
+                                 defineLevelError(problem, earlier, end, NULL);
+    if(error != earlierError){
+        return error < earlierError;
+    }
+    return fewest ? problem->nLevels[split] < problem->nLevels[earlier]
+                  : problem->nLevels[split] > problem->nLevels[earlier];
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t solvePenalized(PenalizedProblem* problem, int64_t penalty,
+                             bool fewest){
+    const size_t n = problem->length;
+    uint32_t* candidates = problem->candidates;
+    uint32_t* starts = problem->starts;
+
+    problem->errors[0] = 0;
+    problem->nLevels[0] = 0;
+    size_t head = 0, tail = 1;
+    candidates[0] = 0;
+    starts[0] = 1;
+
+    for(size_t j = 1; j <= n; j++){
+        //Best split of [0, j)
+        while(head + 1 < tail && starts[head+1] <= j){
+            head++;
+        }
+        const size_t best = candidates[head];
+        problem->errors[j] = problem->errors[best] +
+                             defineLevelError(problem, best, j, NULL) + penalty;
+        problem->nLevels[j] = problem->nLevels[best] + 1;
+        problem->splits[j] = (uint32_t)best;
+        if(j == n){
+            break;
+        }
+
+        //Splits beaten by j wherever they were the best are dropped
+        size_t from = j + 1;
+        while(tail > head){
+            from = starts[tail-1] > j + 1 ? starts[tail-1] : j + 1;
+            if(!isBetterSplit(problem, j, candidates[tail-1], from, fewest)){
+                break;
+            }
+            tail--;
+        }
+        if(tail == head){
+            candidates[tail] = (uint32_t)j;
+            starts[tail] = (uint32_t)(j + 1);
+            tail++;
+            continue;
+        }
+
+        //First end where j beats the last split of the queue
+        size_t lower = from + 1, upper = n + 1;
+        while(lower < upper){
+            size_t middle = lower + (upper - lower)/2;
+            if(isBetterSplit(problem, j, candidates[tail-1], middle, fewest)){
+                upper = middle;
+            }else{
+                lower = middle + 1;
+            }
+        }
+        if(lower <= n){
+            candidates[tail] = (uint32_t)j;
+            starts[tail] = (uint32_t)lower;
+            tail++;
+        }
+    }
+
+    return problem->nLevels[n];
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void extractBounds(const PenalizedProblem* problem, size_t* bounds){
+    size_t end = problem->length;
+    for(size_t k = problem->nLevels[end]; k > 0; k--){
+        bounds[k] = end;
+        end = problem->splits[end];
+    }
+    bounds[0] = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool spliceBounds(const size_t* fewer, size_t nFewer,
+                         const size_t* more, size_t nMore, size_t nLevels,
+                         size_t* bounds){
+    const size_t shift = nLevels - nFewer;
+    for(size_t s = 0; s < nFewer && s + shift < nMore; s++){
+        const size_t t = s + shift;
+        if(fewer[s] <= more[t] && more[t+1] <= fewer[s+1]){
+            for(size_t l = 0; l <= t; l++){
+                bounds[l] = more[l];
+            }
+            for(size_t l = s + 1; l <= nFewer; l++){
+                bounds[t + l - s] = fewer[l];
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool computeReduction(const size_t* histogram, size_t histogramLength,
+                      size_t nLevels, size_t* thresholds, uint16_t* levels){
+    return computeReductionWithSettings(histogram, histogramLength, nLevels,
+                                        thresholds, levels, NULL, NULL);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool computeReductionWithSettings(const size_t* histogram,
+                                  size_t histogramLength, size_t nLevels,
+                                  size_t* thresholds, uint16_t* levels,
+                                  const ReductionSettings* settings,
+                                  ReductionReport* report){
+
+    if(!histogram || histogramLength <= 0 || nLevels <= 0 || !thresholds ||
+       !levels || histogramLength >= UINT32_MAX){
+        return false;
+    }
+    if(!settings){
+        settings = getDefaultReductionSettings();
+    }
+
+    const size_t n = histogramLength;
+    const size_t nSolved = nLevels < n ? nLevels : n;
+
+    uint64_t* moments = malloc(3*(n+1)*sizeof(uint64_t));
+    int64_t* errors = malloc((n+1)*sizeof(int64_t));
+    uint32_t* tables = malloc(4*(n+1)*sizeof(uint32_t));
+    size_t* bounds = malloc(3*(n+1)*sizeof(size_t));
+    if(!moments || !errors || !tables || !bounds){
+        free(moments);
+        free(errors);
+        free(tables);
+        free(bounds);
+        return false;
+    }
+
+    PenalizedProblem problem;
+    problem.count = moments;
+    problem.sum = moments + (n+1);
+    problem.squares = moments + 2*(n+1);
+    problem.length = n;
+    problem.metric = settings->metric;
+    problem.errors = errors;
+    problem.nLevels = tables;
+    problem.splits = tables + (n+1);
+    problem.candidates = tables + 2*(n+1);
+    problem.starts = tables + 3*(n+1);
+    if(!computeMoments(histogram, n, n, settings->weights,
+                       settings->weightsLength, moments, moments + (n+1),
+                       moments + 2*(n+1))){
+        free(moments);
+        free(errors);
+        free(tables);
+        free(bounds);
+        return false;
+    }
+
+    /*
+     * Smallest penalty whose best partition with the fewest levels has at
+     * most k levels: above the error of a single level, one level is best.
+     */
+    int64_t lower = 0;
+    int64_t upper = defineLevelError(&problem, 0, n, NULL) + 1;
+    while(lower < upper){
+        int64_t middle = lower + (upper - lower)/2;
+        if(solvePenalized(&problem, middle, true) <= nSolved){
+            upper = middle;
+        }else{
+            lower = middle + 1;
+        }
+    }
+
+    //The best partitions for this penalty have from p to q >= k levels
+    size_t* fewer = bounds + (n+1);
+    size_t* more = bounds + 2*(n+1);
+    const size_t nFewer = solvePenalized(&problem, lower, true);
+    extractBounds(&problem, fewer);
+    bool wentFine = true;
+    if(nFewer == nSolved){
+        for(size_t l = 0; l <= nSolved; l++){
+            bounds[l] = fewer[l];
+        }
+    }else{
+        const size_t nMore = solvePenalized(&problem, lower, false);
+        extractBounds(&problem, more);
+        wentFine = nMore >= nSolved &&
+                   spliceBounds(fewer, nFewer, more, nMore, nSolved, bounds);
+    }
+
+    if(wentFine){
+        ReductionReport newReport = {false, 0, 0};
+        for(size_t k = 0; k < nSolved; k++){
+            thresholds[k] = bounds[k+1];
+            newReport.error += (uint64_t)defineLevelError(&problem,
+                                                          bounds[k],
+                                                          bounds[k+1],
+                                                          &levels[k]);
+        }
+
+        //If there are fewer levels than expected, the last one is repeated
+        for(size_t k = nSolved; k < nLevels; k++){
+            thresholds[k] = thresholds[nSolved-1];
+            levels[k] = levels[nSolved-1];
+        }
+        if(report){
+            *report = newReport;
+        }
+    }
+
+    free(moments);
+    free(errors);
+    free(tables);
+    free(bounds);
+    return wentFine;
+}
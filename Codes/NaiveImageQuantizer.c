@@ -3,6 +3,9 @@
  * Implementation of a naive algorithm that quantizes an image.
  ***********************************************************************/
 
+#include <stdlib.h>
+#include <math.h>
+
 #include "ImageQuantizer.h"
 
 PortableGrayMap* quantizeGrayImage(const PortableGrayMap* image, size_t numLevels){
@@ -20,3 +23,256 @@ PortableGrayMap* quantizeGrayImage(const PortableGrayMap* image, size_t numLevel
       res->array[i][j] = (uint16_t)(image->array[i][j] / sizeInterval) * sizeInterval + halfSizeInterval;
   return res;
 }
+
+bool quantizeGrayImageInPlace(PortableGrayMap* image, size_t numLevels, const ReductionSettings* settings,
+                              uint16_t* levels, uint64_t* error, ReductionReport* report){
+  (void)settings;
+  if (image == NULL || numLevels == 0)
+    return false;
+  if (report != NULL)
+    *report = (ReductionReport){false, 0, 0};
+
+  const double sizeInterval = (image->maxValue + 1) / (double)numLevels;
+  const double halfSizeInterval = sizeInterval / 2.0;
+  if (levels != NULL)
+    for (size_t k = 0; k < numLevels; k++)
+      levels[k] = (uint16_t)(k * sizeInterval + halfSizeInterval);
+
+  uint64_t squaredError = 0;
+  for (size_t i = 0; i < image->height; i++)
+    for(size_t j = 0; j < image->width; j++){
+      const uint16_t value = (uint16_t)(image->array[i][j] / sizeInterval) * sizeInterval + halfSizeInterval;
+      const int64_t delta = (int64_t)image->array[i][j] - value;
+      squaredError += (uint64_t)(delta * delta);
+      image->array[i][j] = value;
+    }
+  if (error != NULL)
+    *error = squaredError;
+  return true;
+}
+
+GrayMapping* computeGrayMapping(const size_t* histogram, size_t histogramLength, size_t numLevels,
+                                const ReductionSettings* settings){
+  (void)settings;
+  if (histogram == NULL || histogramLength == 0 || histogramLength > 65536 || numLevels == 0)
+    return NULL;
+
+  GrayMapping* res = createEmptyMapping(histogramLength, numLevels);
+  if (res == NULL)
+    return NULL;
+
+  const double sizeInterval = histogramLength / (double)numLevels;
+  const double halfSizeInterval = sizeInterval / 2.0;
+  for (size_t k = 0; k < numLevels; k++){
+    res->levels[k] = (uint16_t)(k * sizeInterval + halfSizeInterval);
+    res->thresholds[k] = histogramLength;
+  }
+
+  // Level k applies to the gray levels [p_{k-1}, p_k)
+  for (size_t i = 0; i < histogramLength; i++){
+    const size_t k = (size_t)(i / sizeInterval);
+    res->lut[i] = (uint16_t)(k * sizeInterval + halfSizeInterval);
+    if (k > 0 && res->thresholds[k - 1] > i)
+      res->thresholds[k - 1] = i;
+    const int64_t delta = (int64_t)i - res->lut[i];
+    res->error += (uint64_t)histogram[i] * (uint64_t)(delta * delta);
+  }
+
+  // Levels covering no gray level (k > n) get empty intervals
+  for (size_t k = numLevels - 1; k > 0; k--)
+    if (res->thresholds[k - 1] > res->thresholds[k])
+      res->thresholds[k - 1] = res->thresholds[k];
+  return res;
+}
+
+GrayMapping* computeImageMapping(const PortableGrayMap* image, size_t numLevels, const ReductionSettings* settings){
+  if (image == NULL || numLevels == 0)
+    return NULL;
+
+  size_t* histogram = calloc((size_t)image->maxValue + 1, sizeof(size_t));
+  if (histogram == NULL)
+    return NULL;
+
+  for (size_t i = 0; i < image->height; i++)
+    for(size_t j = 0; j < image->width; j++)
+      histogram[image->array[i][j]]++;
+
+  GrayMapping* res = computeGrayMapping(histogram, (size_t)image->maxValue + 1, numLevels, settings);
+  free(histogram);
+  return res;
+}
+
+GrayMapping* computeStreamMapping(FILE* file, int kind, size_t numLevels, const ReductionSettings* settings){
+  PortableGrayMap header;
+  if (file == NULL || numLevels == 0 || readImageHeader(file, kind, &header) != 0)
+    return NULL;
+
+  size_t* histogram = calloc((size_t)header.maxValue + 1, sizeof(size_t));
+  uint16_t* row = malloc(header.width * sizeof(uint16_t));
+  if (histogram == NULL || (row == NULL && header.width > 0)){
+    free(histogram);
+    free(row);
+    return NULL;
+  }
+
+  // Rows are counted as they are read, the image is never held
+  GrayMapping* res = NULL;
+  size_t i = 0;
+  for (; i < header.height && readImageRow(file, &header, row) == 0; i++)
+    for(size_t j = 0; j < header.width; j++)
+      histogram[row[j]]++;
+  if (i == header.height)
+    res = computeGrayMapping(histogram, (size_t)header.maxValue + 1, numLevels, settings);
+  free(row);
+  free(histogram);
+  return res;
+}
+
+bool quantizeGrayImagesShared(PortableGrayMap** images, size_t nImages, size_t numLevels, const ReductionSettings* settings,
+                              uint16_t* levels, uint64_t* errors, ReductionReport* report){
+  (void)settings;
+  if (images == NULL || nImages == 0 || numLevels == 0)
+    return false;
+  if (report != NULL)
+    *report = (ReductionReport){false, 0, 0};
+
+  // The uniform levels cover the gray levels of every image
+  uint16_t maxValue = 0;
+  for (size_t n = 0; n < nImages; n++){
+    if (images[n] == NULL)
+      return false;
+    if (images[n]->maxValue > maxValue)
+      maxValue = images[n]->maxValue;
+  }
+
+  const double sizeInterval = (maxValue + 1) / (double)numLevels;
+  const double halfSizeInterval = sizeInterval / 2.0;
+  if (levels != NULL)
+    for (size_t k = 0; k < numLevels; k++)
+      levels[k] = (uint16_t)(k * sizeInterval + halfSizeInterval);
+
+  for (size_t n = 0; n < nImages; n++){
+    PortableGrayMap* image = images[n];
+    uint64_t squaredError = 0;
+    for (size_t i = 0; i < image->height; i++)
+      for(size_t j = 0; j < image->width; j++){
+        const uint16_t value = (uint16_t)(image->array[i][j] / sizeInterval) * sizeInterval + halfSizeInterval;
+        const int64_t delta = (int64_t)image->array[i][j] - value;
+        squaredError += (uint64_t)(delta * delta);
+        image->array[i][j] = value;
+      }
+    if (errors != NULL)
+      errors[n] = squaredError;
+
+    // The levels may exceed the gray levels of the image
+    image->maxValue = (uint16_t)((numLevels - 1) * sizeInterval + halfSizeInterval);
+  }
+  return true;
+}
+
+static uint16_t getViewPixel(const GrayImageView* view, size_t i, size_t j){
+  const unsigned char* row = (const unsigned char*)view->pixels + i * view->stride;
+  return view->bitDepth == 8 ? row[j] : ((const uint16_t*)row)[j];
+}
+
+static void setViewPixel(const GrayImageView* view, size_t i, size_t j, uint16_t value){
+  unsigned char* row = (unsigned char*)view->pixels + i * view->stride;
+  if (view->bitDepth == 8)
+    row[j] = (unsigned char)value;
+  else
+    ((uint16_t*)row)[j] = value;
+}
+
+bool quantizeGrayView(const GrayImageView* input, GrayImageView* output, size_t numLevels, const ReductionSettings* settings,
+                      uint16_t* levels, uint64_t* error){
+  (void)settings;
+  if (input == NULL || output == NULL || numLevels == 0 ||
+      (input->bitDepth != 8 && input->bitDepth != 16) || (output->bitDepth != 8 && output->bitDepth != 16) ||
+      input->width != output->width || input->height != output->height)
+    return false;
+
+  const double sizeInterval = (input->maxValue + 1) / (double)numLevels;
+  const double halfSizeInterval = sizeInterval / 2.0;
+  const uint16_t lastLevel = (uint16_t)((numLevels - 1) * sizeInterval + halfSizeInterval);
+  if (output->bitDepth == 8 && lastLevel > 255)
+    return false;
+  if (levels != NULL)
+    for (size_t k = 0; k < numLevels; k++)
+      levels[k] = (uint16_t)(k * sizeInterval + halfSizeInterval);
+
+  uint64_t squaredError = 0;
+  for (size_t i = 0; i < input->height; i++)
+    for(size_t j = 0; j < input->width; j++){
+      const uint16_t pixel = getViewPixel(input, i, j);
+      const uint16_t value = (uint16_t)(pixel / sizeInterval) * sizeInterval + halfSizeInterval;
+      const int64_t delta = (int64_t)pixel - value;
+      squaredError += (uint64_t)(delta * delta);
+      setViewPixel(output, i, j, value);
+    }
+  output->maxValue = lastLevel;
+  if (error != NULL)
+    *error = squaredError;
+  return true;
+}
+
+static double getWideSample(const WideImageView* view, size_t i, size_t j){
+  const unsigned char* row = (const unsigned char*)view->pixels + i * view->stride;
+  return view->format == SAMPLE_UINT32 ? ((const uint32_t*)row)[j] : ((const float*)row)[j];
+}
+
+static void setWideSample(const WideImageView* view, size_t i, size_t j, double value){
+  unsigned char* row = (unsigned char*)view->pixels + i * view->stride;
+  if (view->format == SAMPLE_UINT32)
+    ((uint32_t*)row)[j] = (uint32_t)value;
+  else
+    ((float*)row)[j] = (float)value;
+}
+
+bool quantizeWideView(const WideImageView* input, WideImageView* output, size_t numLevels, const ReductionSettings* settings,
+                      double* levels, double* error){
+  (void)settings;
+  if (input == NULL || output == NULL || numLevels == 0 || input->format != output->format ||
+      (input->format != SAMPLE_UINT32 && input->format != SAMPLE_FLOAT32) ||
+      input->width != output->width || input->height != output->height)
+    return false;
+
+  double lowest = 0.0, highest = 0.0;
+  for (size_t i = 0; i < input->height; i++)
+    for(size_t j = 0; j < input->width; j++){
+      const double sample = getWideSample(input, i, j);
+      if (!isfinite(sample))
+        return false;
+      if ((i == 0 && j == 0) || sample < lowest)
+        lowest = sample;
+      if ((i == 0 && j == 0) || sample > highest)
+        highest = sample;
+    }
+
+  // Levels at the centers of k intervals of equal size
+  const double sizeInterval = (highest - lowest) / numLevels;
+  double* centers = malloc(numLevels * sizeof(double));
+  if (centers == NULL)
+    return false;
+  for (size_t k = 0; k < numLevels; k++){
+    centers[k] = lowest + (k + 0.5) * sizeInterval;
+    centers[k] = input->format == SAMPLE_UINT32 ? (double)(uint64_t)(centers[k] + 0.5) : (float)centers[k];
+  }
+
+  double squaredError = 0.0;
+  for (size_t i = 0; i < input->height; i++)
+    for(size_t j = 0; j < input->width; j++){
+      const double sample = getWideSample(input, i, j);
+      size_t k = sizeInterval > 0.0 ? (size_t)((sample - lowest) / sizeInterval) : 0;
+      const double value = centers[k < numLevels ? k : numLevels - 1];
+      squaredError += (sample - value) * (sample - value);
+      setWideSample(output, i, j, value);
+    }
+
+  if (levels != NULL)
+    for (size_t k = 0; k < numLevels; k++)
+      levels[k] = centers[k];
+  if (error != NULL)
+    *error = squaredError;
+  free(centers);
+  return true;
+}
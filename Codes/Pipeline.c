@@ -0,0 +1,667 @@
+/* ========================================================================== *
+ * Pipeline                                                                   *
+ * Implementation of the interface Pipeline.h                                 *
+ * ========================================================================== */
+
+/* ========================================================================== *
+ *                                  HEADER                                    *
+ * ========================================================================== */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "Pipeline.h"
+#include "PortableGrayMap.h"
+#include "ImageQuantizer.h"
+#include "PortablePixMap.h"
+#include "PortableFloatMap.h"
+#include "ColorQuantizer.h"
+#include "ReductionSettings.h"
+
+#define DEFAULT_QUEUE_DEPTH 2
+
+/* ========================================================================== *
+ *                                   TYPES                                    *
+ * ========================================================================== */
+
+/* An image travelling from one stage to the next one */
+typedef struct {
+    size_t index;               // Position of the input in the batch
+    size_t position;            // Position of the image in its input stream
+    PortableGrayMap* image;     // Gray image, NULL if none
+    PortablePixMap* colorImage; // Colour image, NULL if none
+    PortableFloatMap* floatImage; // Floating-point image, NULL if none
+    unsigned long error;        // Compression error (once quantized)
+    double floatError;          // Compression error of a floating-point image
+    ReductionReport report;     // Report of an approximate reduction
+    const char* failure;        // Reason of the failure, if any
+} PipelineItem;
+
+/* Bounded FIFO queue between two stages */
+typedef struct {
+    PipelineItem* items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool closed;                // No more items will be pushed
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+} ImageQueue;
+
+/* State shared by the three stages */
+typedef struct {
+    const char* const* inputNames;
+    const char* const* outputNames;
+    size_t nImages;
+    size_t numLevels;
+    bool sharedLevels;          // Same levels for all the gray images
+    const ReductionSettings* reduction; // Tuning of the gray reductions
+    FILE* report;               // Where the compression errors are printed
+
+    size_t memoryLimit;
+    size_t bytesInFlight;
+    pthread_mutex_t memoryMutex;
+    pthread_cond_t memoryReleased;
+
+    ImageQueue loaded;          // Load -> quantize
+    ImageQueue quantized;       // Quantize -> save
+} Pipeline;
+
+/* ========================================================================== *
+ *                                 PROTOTYPES                                 *
+ * ========================================================================== */
+
+/* -------------------------------------------------------------------------- *
+ * Initialize an empty queue                                                  *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * queue            A valid pointer to the queue to initialize                *
+ * capacity         The maximal number of items in the queue (> 0)            *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If the initialization went fine                           *
+ * false            Else                                                      *
+ * -------------------------------------------------------------------------- */
+static bool initQueue(ImageQueue* queue, size_t capacity);
+
+/* -------------------------------------------------------------------------- *
+ * Release the resources of a queue                                           *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * queue            A valid pointer to an initialized queue                   *
+ * -------------------------------------------------------------------------- */
+static void destroyQueue(ImageQueue* queue);
+
+/* -------------------------------------------------------------------------- *
+ * Append an item to a queue, waiting while the queue is full                 *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * queue            A valid pointer to an initialized queue                   *
+ * item             The item to append                                        *
+ * -------------------------------------------------------------------------- */
+static void pushQueue(ImageQueue* queue, PipelineItem item);
+
+/* -------------------------------------------------------------------------- *
+ * Remove the first item of a queue, waiting while the queue is empty         *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * queue            A valid pointer to an initialized queue                   *
+ * item             A valid pointer where the removed item will be stored     *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If an item was removed                                    *
+ * false            If the queue is closed and empty                          *
+ * -------------------------------------------------------------------------- */
+static bool popQueue(ImageQueue* queue, PipelineItem* item);
+
+/* -------------------------------------------------------------------------- *
+ * State that no more items will be appended to a queue                       *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * queue            A valid pointer to an initialized queue                   *
+ * -------------------------------------------------------------------------- */
+static void closeQueue(ImageQueue* queue);
+
+/* -------------------------------------------------------------------------- *
+ * Size in bytes of the raster of an image                                    *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image            A valid pointer to an image                               *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * size             The number of bytes used by the pixels of the image       *
+ * -------------------------------------------------------------------------- */
+static size_t rasterSize(const PortableGrayMap* image);
+static size_t pixMapRasterSize(const PortablePixMap* image);
+static size_t floatMapRasterSize(const PortableFloatMap* image);
+
+/* -------------------------------------------------------------------------- *
+ * Account for (de)allocated rasters in the pipeline                          *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * pipeline         A valid pointer to the pipeline                           *
+ * acquired         Number of bytes newly allocated                           *
+ * released         Number of bytes freed                                     *
+ * -------------------------------------------------------------------------- */
+static void updateMemory(Pipeline* pipeline, size_t acquired, size_t released);
+
+/* -------------------------------------------------------------------------- *
+ * Compute the squared error between a colour image and its quantized version *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image            The original image                                        *
+ * quantized        The quantized image, of the same size                     *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * error            The sum of squared differences of all pixels              *
+ * -------------------------------------------------------------------------- */
+static unsigned long computePixMapError(const PortablePixMap* image,
+                                        const PortablePixMap* quantized);
+
+/* -------------------------------------------------------------------------- *
+ * Release the image of an item, if any                                       *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * pipeline         The pipeline                                              *
+ * item             The item of the image, left without image                 *
+ * -------------------------------------------------------------------------- */
+static void releaseItem(Pipeline* pipeline, PipelineItem* item);
+
+/* -------------------------------------------------------------------------- *
+ * Quantize a gray, colour or floating-point image on its own levels          *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * pipeline         The pipeline                                              *
+ * item             The item of the image, updated with the result            *
+ * -------------------------------------------------------------------------- */
+static void quantizeItem(Pipeline* pipeline, PipelineItem* item);
+
+/* -------------------------------------------------------------------------- *
+ * Bodies of the three stages of the pipeline, the quantize stage waiting for *
+ * the whole batch with shared levels                                         *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * arg              A valid pointer to the pipeline                           *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * NULL             Always (load and quantize stages)                         *
+ * nFailed          Number of images that failed (save stage)                 *
+ * -------------------------------------------------------------------------- */
+static void* loadStage(void* arg);
+static void* quantizeStage(void* arg);
+static void* quantizeSharedStage(void* arg);
+static size_t saveStage(Pipeline* pipeline);
+
+/* ========================================================================== *
+ *                                  FUNCTIONS                                 *
+ * ========================================================================== */
+
+static bool initQueue(ImageQueue* queue, size_t capacity){
+    queue->items = malloc(capacity*sizeof(PipelineItem));
+    if(!queue->items){
+        return false;
+    }
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = false;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void destroyQueue(ImageQueue* queue){
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_cond_destroy(&queue->notFull);
+    free(queue->items);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void pushQueue(ImageQueue* queue, PipelineItem item){
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->count == queue->capacity){
+        pthread_cond_wait(&queue->notFull, &queue->mutex);
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool popQueue(ImageQueue* queue, PipelineItem* item){
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->count == 0 && !queue->closed){
+        pthread_cond_wait(&queue->notEmpty, &queue->mutex);
+    }
+    if(queue->count == 0){
+        pthread_mutex_unlock(&queue->mutex);
+        return false;
+    }
+    *item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->notFull);
+    pthread_mutex_unlock(&queue->mutex);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void closeQueue(ImageQueue* queue){
+    pthread_mutex_lock(&queue->mutex);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t rasterSize(const PortableGrayMap* image){
+    return image->width*image->height*sizeof(uint16_t);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t pixMapRasterSize(const PortablePixMap* image){
+    return 3*image->width*image->height*sizeof(uint16_t);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t floatMapRasterSize(const PortableFloatMap* image){
+    return image->width*image->height*sizeof(float);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void updateMemory(Pipeline* pipeline, size_t acquired, size_t released){
+    pthread_mutex_lock(&pipeline->memoryMutex);
+    pipeline->bytesInFlight += acquired;
+    pipeline->bytesInFlight -= released;
+    if(released > 0){
+        pthread_cond_broadcast(&pipeline->memoryReleased);
+    }
+    pthread_mutex_unlock(&pipeline->memoryMutex);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static unsigned long computePixMapError(const PortablePixMap* image,
+                                        const PortablePixMap* quantized){
+    unsigned long error = 0;
+    long errComp = 0;
+    for(size_t i = 0; i < image->height; i++){
+        for(size_t j = 0; j < 3*image->width; j++){
+            errComp = (long)(image->array[i][j]) -
+                      (long)(quantized->array[i][j]);
+            error += (unsigned long)(errComp*errComp);
+        }
+    }
+    return error;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void* loadStage(void* arg){
+    Pipeline* pipeline = arg;
+
+    for(size_t i = 0; i < pipeline->nImages; i++){
+        //Each input is a stream of images, "-" being stdin
+        FILE* file = openImageFile(pipeline->inputNames[i], false);
+
+        size_t position = 0;
+        bool failed = false;
+        do{
+            //Wait until the images in flight fit in the memory limit
+            pthread_mutex_lock(&pipeline->memoryMutex);
+            while(pipeline->memoryLimit > 0 &&
+                  pipeline->bytesInFlight >= pipeline->memoryLimit){
+                pthread_cond_wait(&pipeline->memoryReleased,
+                                  &pipeline->memoryMutex);
+            }
+            pthread_mutex_unlock(&pipeline->memoryMutex);
+
+            PipelineItem item = {i, position, NULL, NULL, NULL, 0, 0.0,
+                                 {false, 0, 0}, NULL};
+            //The magic number of each image, read once, chooses its reader
+            const int kind = readMagicNumber(file);
+            if(kind == '3' || kind == '6'){
+                item.colorImage = createPixMapAfterMagic(file, kind);
+            }else if(kind == 'f'){
+                item.floatImage = createFloatMapAfterMagic(file, kind);
+            }else{
+                item.image = createImageAfterMagic(file, kind);
+            }
+            if(item.image){
+                updateMemory(pipeline, rasterSize(item.image), 0);
+            }else if(item.colorImage){
+                updateMemory(pipeline, pixMapRasterSize(item.colorImage), 0);
+            }else if(item.floatImage){
+                updateMemory(pipeline, floatMapRasterSize(item.floatImage), 0);
+            }else{
+                item.failure = "error while loading input image";
+            }
+            pushQueue(&pipeline->loaded, item);
+
+            //The rest of a stream cannot be parsed after an error
+            if(item.failure){
+                failed = true;
+                break;
+            }
+            position++;
+        }while(!isEndOfStream(file));
+
+        //A corrupted compressed file may only be noticed at its end
+        if(file && closeImageFile(file) != 0 && !failed){
+            PipelineItem item = {i, position, NULL, NULL, NULL, 0, 0.0,
+                                 {false, 0, 0},
+                                 "error while decompressing input file"};
+            pushQueue(&pipeline->loaded, item);
+        }
+    }
+
+    closeQueue(&pipeline->loaded);
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void releaseItem(Pipeline* pipeline, PipelineItem* item){
+    if(item->image){
+        updateMemory(pipeline, 0, rasterSize(item->image));
+        deleteImage(item->image);
+        item->image = NULL;
+    }
+    if(item->colorImage){
+        updateMemory(pipeline, 0, pixMapRasterSize(item->colorImage));
+        deletePixMap(item->colorImage);
+        item->colorImage = NULL;
+    }
+    if(item->floatImage){
+        updateMemory(pipeline, 0, floatMapRasterSize(item->floatImage));
+        deleteFloatMap(item->floatImage);
+        item->floatImage = NULL;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void quantizeItem(Pipeline* pipeline, PipelineItem* item){
+    if(item->image){
+        //The original pixels are not needed once quantized
+        uint64_t error = 0;
+        if(quantizeGrayImageInPlace(item->image, pipeline->numLevels,
+                                    pipeline->reduction, NULL, &error,
+                                    &item->report)){
+            item->error = (unsigned long)error;
+        }else{
+            item->failure = "error while computing the reduction";
+            updateMemory(pipeline, 0, rasterSize(item->image));
+            deleteImage(item->image);
+            item->image = NULL;
+        }
+    }else if(item->colorImage){
+        PortablePixMap* input = item->colorImage;
+        item->colorImage = quantizeColorImage(input, pipeline->numLevels);
+        if(item->colorImage){
+            updateMemory(pipeline, pixMapRasterSize(item->colorImage), 0);
+            item->error = computePixMapError(input, item->colorImage);
+        }else{
+            item->failure = "error while computing the palette";
+        }
+        updateMemory(pipeline, 0, pixMapRasterSize(input));
+        deletePixMap(input);
+    }else if(item->floatImage){
+        //The samples are quantized in place, through a view on the raster
+        PortableFloatMap* image = item->floatImage;
+        WideImageView view = {image->array, image->width, image->height,
+                              image->width*sizeof(float), SAMPLE_FLOAT32};
+        if(!quantizeWideView(&view, &view, pipeline->numLevels,
+                             pipeline->reduction, NULL, &item->floatError)){
+            item->failure = "error while computing the reduction";
+            releaseItem(pipeline, item);
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void* quantizeStage(void* arg){
+    Pipeline* pipeline = arg;
+    PipelineItem item;
+
+    while(popQueue(&pipeline->loaded, &item)){
+        quantizeItem(pipeline, &item);
+        pushQueue(&pipeline->quantized, item);
+    }
+
+    closeQueue(&pipeline->quantized);
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void* quantizeSharedStage(void* arg){
+    Pipeline* pipeline = arg;
+    PipelineItem item;
+
+    //The levels depend on every image of the batch
+    PipelineItem* items = NULL;
+    size_t nItems = 0, capacity = 0;
+    while(popQueue(&pipeline->loaded, &item)){
+        if(nItems == capacity){
+            size_t newCapacity = capacity > 0 ? 2*capacity : 16;
+            PipelineItem* newItems = realloc(items, newCapacity*
+                                                    sizeof(PipelineItem));
+            if(!newItems){
+                //A failed item opens no output, so it may be saved early
+                releaseItem(pipeline, &item);
+                if(!item.failure){
+                    item.failure = "out of memory";
+                }
+                pushQueue(&pipeline->quantized, item);
+                continue;
+            }
+            items = newItems;
+            capacity = newCapacity;
+        }
+        items[nItems++] = item;
+    }
+
+    //A single reduction for all the gray images
+    PortableGrayMap** images = malloc((nItems > 0 ? nItems : 1)*
+                                      sizeof(PortableGrayMap*));
+    uint64_t* errors = malloc((nItems > 0 ? nItems : 1)*sizeof(uint64_t));
+    size_t nGray = 0;
+    for(size_t i = 0; i < nItems; i++){
+        if(items[i].image && images){
+            images[nGray++] = items[i].image;
+        }
+    }
+    ReductionReport report = {false, 0, 0};
+    const bool reduced = nGray > 0 && images && errors &&
+                         quantizeGrayImagesShared(images, nGray,
+                                                  pipeline->numLevels,
+                                                  pipeline->reduction, NULL,
+                                                  errors, &report);
+
+    for(size_t i = 0, g = 0; i < nItems; i++){
+        if(!items[i].image){
+            quantizeItem(pipeline, &items[i]);
+        }else if(reduced){
+            items[i].error = (unsigned long)errors[g++];
+            items[i].report = report;
+        }else{
+            items[i].failure = "error while computing the reduction";
+            updateMemory(pipeline, 0, rasterSize(items[i].image));
+            deleteImage(items[i].image);
+            items[i].image = NULL;
+        }
+        pushQueue(&pipeline->quantized, items[i]);
+    }
+
+    free(items);
+    free(images);
+    free(errors);
+    closeQueue(&pipeline->quantized);
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t saveStage(Pipeline* pipeline){
+    size_t nFailed = 0;
+    PipelineItem item;
+
+    //The images of an input are written back to back in the same output
+    FILE* output = NULL;
+    size_t outputIndex = pipeline->nImages;
+
+    while(popQueue(&pipeline->quantized, &item)){
+        const char* inputName = pipeline->inputNames[item.index];
+        const char* outputName = pipeline->outputNames[item.index];
+        const bool toStdout = strcmp(outputName, "-") == 0;
+
+        if(!item.failure && item.index != outputIndex){
+            if(output && closeImageFile(output) != 0){
+                fprintf(stderr, "Skipping '%s'; error while saving output "
+                        "image\n", pipeline->inputNames[outputIndex]);
+                nFailed++;
+            }
+            output = openImageFile(outputName, true);
+            outputIndex = item.index;
+        }
+
+        if((item.image || item.colorImage || item.floatImage) && !output){
+            item.failure = "error while opening output image";
+        }else if((item.image && saveImageToStream(item.image, output) != 0) ||
+                 (item.colorImage &&
+                  savePixMapToStream(item.colorImage, output) != 0) ||
+                 (item.floatImage &&
+                  saveFloatMapToStream(item.floatImage, output) != 0) ||
+                 (toStdout && fflush(stdout) != 0)){
+            item.failure = "error while saving output image";
+        }
+
+        //Floating-point samples give a real error
+        char errorText[32];
+        if(item.floatImage){
+            snprintf(errorText, sizeof(errorText), "%.6g", item.floatError);
+        }else{
+            snprintf(errorText, sizeof(errorText), "%lu", item.error);
+        }
+
+        if(item.failure){
+            fprintf(stderr, "Skipping '%s'; %s\n", inputName, item.failure);
+            nFailed++;
+        }else if(item.position > 0){
+            fprintf(pipeline->report, "Compression error (%s, image %zu): "
+                    "%s\n", outputName, item.position + 1, errorText);
+        }else if(pipeline->nImages == 1){
+            fprintf(pipeline->report, "Compression error: %s\n", errorText);
+        }else{
+            fprintf(pipeline->report, "Compression error (%s): %s\n",
+                    outputName, errorText);
+        }
+        if(!item.failure && item.report.approximate){
+            fprintf(pipeline->report, "Gap to the optimal error: at most %"
+                    PRIu64 "\n", item.report.errorBound);
+        }
+
+        releaseItem(pipeline, &item);
+    }
+
+    if(output && closeImageFile(output) != 0){
+        fprintf(stderr, "Skipping '%s'; error while saving output image\n",
+                pipeline->inputNames[outputIndex]);
+        nFailed++;
+    }
+    return nFailed;
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t runQuantizationPipeline(const char* const* inputNames,
+                               const char* const* outputNames,
+                               size_t nImages, size_t numLevels,
+                               const PipelineSettings* settings){
+    if(!inputNames || !outputNames || nImages == 0){
+        return nImages;
+    }
+
+    size_t queueDepth = DEFAULT_QUEUE_DEPTH;
+    size_t memoryLimit = 0;
+    bool sharedLevels = false;
+    const ReductionSettings* reduction = NULL;
+    if(settings){
+        if(settings->queueDepth > 0){
+            queueDepth = settings->queueDepth;
+        }
+        sharedLevels = settings->sharedLevels;
+        reduction = settings->reduction;
+
+        //Shared levels keep every image until the last one is loaded
+        memoryLimit = sharedLevels ? 0 : settings->memoryLimit;
+    }
+
+    Pipeline pipeline;
+    pipeline.inputNames = inputNames;
+    pipeline.outputNames = outputNames;
+    pipeline.nImages = nImages;
+    pipeline.numLevels = numLevels;
+    pipeline.sharedLevels = sharedLevels;
+    pipeline.reduction = reduction;
+    pipeline.report = stdout;
+    pipeline.memoryLimit = memoryLimit;
+    pipeline.bytesInFlight = 0;
+
+    //The standard output may carry images instead of the report
+    for(size_t i = 0; i < nImages; i++){
+        if(strcmp(outputNames[i], "-") == 0){
+            pipeline.report = stderr;
+        }
+    }
+
+    if(!initQueue(&pipeline.loaded, queueDepth)){
+        return nImages;
+    }
+    if(!initQueue(&pipeline.quantized, queueDepth)){
+        destroyQueue(&pipeline.loaded);
+        return nImages;
+    }
+    pthread_mutex_init(&pipeline.memoryMutex, NULL);
+    pthread_cond_init(&pipeline.memoryReleased, NULL);
+
+    //The save stage runs on the calling thread
+    size_t nFailed = nImages;
+    pthread_t loader, quantizer;
+    if(pthread_create(&quantizer, NULL, sharedLevels ? quantizeSharedStage
+                                                     : quantizeStage,
+                      &pipeline) == 0){
+        if(pthread_create(&loader, NULL, loadStage, &pipeline) == 0){
+            nFailed = saveStage(&pipeline);
+            pthread_join(loader, NULL);
+        }else{
+            closeQueue(&pipeline.loaded);
+            saveStage(&pipeline);
+        }
+        pthread_join(quantizer, NULL);
+    }
+
+    pthread_mutex_destroy(&pipeline.memoryMutex);
+    pthread_cond_destroy(&pipeline.memoryReleased);
+    destroyQueue(&pipeline.quantized);
+    destroyQueue(&pipeline.loaded);
+    return nFailed;
+}
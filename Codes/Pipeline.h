@@ -0,0 +1,72 @@
+/***********************************************************************
+ * Pipeline
+ * Overlapped load -> quantize -> save execution over a batch of images.
+ *
+ * Each stage runs on its own thread and stages are connected by bounded
+ * queues, so that reading image N+1 and writing image N-1 happen while
+ * image N is being quantized.
+ ***********************************************************************/
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ReductionSettings.h"
+
+/* Types */
+
+/* Tuning of the pipeline */
+typedef struct
+{
+  size_t queueDepth;            // Max images waiting between two stages
+  size_t memoryLimit;           // Max raster bytes in flight (0: no limit)
+  bool sharedLevels;            // Quantize all gray images on the same levels
+  const ReductionSettings* reduction; // Tuning of the gray reductions
+                                // (NULL: the defaults)
+} PipelineSettings;
+
+/* Functions */
+
+/***********************************************************************
+ * Quantize a batch of images in k levels of gray and save them, the
+ * i-th input being saved under the i-th output name. Colour (PPM) inputs
+ * are reduced to a palette of k colours instead. The compression
+ * error of each image is printed on the standard output, in the order
+ * of the inputs, along with the bound on the gap to the optimal error
+ * reported by an approximate reduction.
+ *
+ * Each input is read as a stream of images (netpbm allows several
+ * images back to back in one file), which are quantized as they arrive
+ * and written back to back under the matching output name. The name
+ * "-" stands for the standard input or output, and the errors are then
+ * printed on the standard error instead. The standard input can only
+ * carry PGM images.
+ *
+ * The memory limit is a soft one: a new image is only loaded once the
+ * rasters in flight fit in the limit, so that it can be exceeded by at
+ * most one image.
+ *
+ * With shared levels, the gray images of the whole batch are quantized
+ * on the same k levels by quantizeGrayImagesShared(), so that they are
+ * all kept in memory until the last one is loaded, whatever the memory
+ * limit. Colour images still get a palette of their own.
+ *
+ * PARAMETERS
+ * inputNames       - File names of the images to quantize ("-": stdin)
+ * outputNames      - File names where the quantized images are saved
+ *                    ("-": stdout)
+ * nImages          - Number of inputs in the batch
+ * numLevels        - The new number of gray levels (0 < k <= n)
+ * settings         - Tuning of the pipeline (NULL for the defaults)
+ *
+ * RETURN
+ * nFailed          - Number of images that could not be processed
+ ***********************************************************************/
+size_t runQuantizationPipeline(const char* const* inputNames,
+                               const char* const* outputNames,
+                               size_t nImages, size_t numLevels,
+                               const PipelineSettings* settings);
+
+#endif // !_PIPELINE_H_
@@ -0,0 +1,196 @@
+/***********************************************************************
+ * PortableFloatMap
+ * Implementation of the interface PortableFloatMap.h
+ *
+ * Documentation about the PFM format can be found at
+ * http://netpbm.sourceforge.net/doc/pfm.html
+ ************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "PortableFloatMap.h"
+#include "PortableGrayMap.h"
+
+/***********************************************************************
+ * Read the real scale ending the header, whose sign gives the byte
+ * order of the samples. The single white space ending it is consumed.
+ ***********************************************************************/
+static int readHeaderScale(FILE* file, double* scale)
+{
+  char text[64];
+  size_t length = 0;
+  int nextChar = fgetc(file);
+  while (nextChar != EOF && isspace(nextChar))
+    nextChar = fgetc(file);
+  while (nextChar != EOF && !isspace(nextChar) && length + 1 < sizeof(text))
+  {
+    text[length++] = (char)nextChar;
+    nextChar = fgetc(file);
+  }
+  text[length] = '\0';
+
+  char* end = NULL;
+  *scale = strtod(text, &end);
+  if (length == 0 || *end != '\0' || *scale == 0.0 || nextChar == EOF)
+    return -1;
+  return 0;
+}
+
+/***********************************************************************
+ * Swap the bytes of 4-byte samples, in place, when their byte order is
+ * not the one of the host.
+ ***********************************************************************/
+static void convertSampleOrder(float* samples, size_t length,
+                               bool littleEndian)
+{
+  const uint16_t probe = 1;
+  const bool hostLittleEndian = *(const unsigned char*)&probe == 1;
+  if (hostLittleEndian == littleEndian)
+    return;
+
+  for (size_t j = 0; j < length; ++j)
+  {
+    uint32_t word;
+    memcpy(&word, &samples[j], sizeof(word));
+    word = (word >> 24) | ((word >> 8) & 0xFF00u) |
+           ((word << 8) & 0xFF0000u) | (word << 24);
+    memcpy(&samples[j], &word, sizeof(word));
+  }
+}
+
+PortableFloatMap* createFloatMapFromFile(const char* filename)
+{
+  FILE* file = openImageFile(filename, false);
+  if (!file)
+    return NULL;
+
+  // A corrupted compressed file may only be noticed at its end
+  PortableFloatMap* res = createFloatMapFromStream(file);
+  if (closeImageFile(file) != 0)
+  {
+    deleteFloatMap(res);
+    return NULL;
+  }
+  return res;
+}
+
+PortableFloatMap* createFloatMapFromStream(FILE* file)
+{
+  if (file == NULL)
+    return NULL;
+  return createFloatMapAfterMagic(file, readMagicNumber(file));
+}
+
+PortableFloatMap* createFloatMapAfterMagic(FILE* file, int kind)
+{
+  // File encoding
+  if (file == NULL || kind != 'f')
+    return NULL;
+
+  // read width, height and scale
+  unsigned long width = 0, height = 0;
+  double scale = 0.0;
+  if (readHeaderValue(file, &width) != 0 ||
+      readHeaderValue(file, &height) != 0 ||
+      readHeaderScale(file, &scale) != 0)
+    return NULL;
+
+  // create image
+  PortableFloatMap* res = createEmptyFloatMap(width, height);
+  if (res == NULL)
+    return NULL;
+
+  // fill image, the rows being stored from the bottom one
+  for (size_t i = res->height; i > 0; --i)
+  {
+    float* row = res->array + (i - 1) * res->width;
+    if (fread(row, sizeof(float), res->width, file) != res->width)
+    {
+      deleteFloatMap(res);
+      return NULL;
+    }
+    convertSampleOrder(row, res->width, scale < 0.0);
+  }
+
+  return res;
+}
+
+int saveFloatMapToFile(const PortableFloatMap* image, const char* filename)
+{
+  if (image == NULL || filename == NULL)
+    return -1;
+
+  FILE* file = openImageFile(filename, true);
+  if (file == NULL)
+  {
+    return -1;
+  }
+
+  int failed = saveFloatMapToStream(image, file);
+  if (closeImageFile(file) != 0 || failed)
+    return -1;
+  return 0;
+}
+
+int saveFloatMapToStream(const PortableFloatMap* image, FILE* file)
+{
+  if (image == NULL || file == NULL)
+    return -1;
+
+  fprintf(file, "Pf\n%zu %zu\n-1.0\n", image->width, image->height);
+
+  // Rows are converted in a buffer, from the bottom one
+  float* row = malloc(image->width * sizeof(float));
+  if (row == NULL && image->width > 0)
+    return -1;
+
+  for (size_t i = image->height; i > 0; --i)
+  {
+    memcpy(row, image->array + (i - 1) * image->width,
+           image->width * sizeof(float));
+    convertSampleOrder(row, image->width, true);
+    if (fwrite(row, sizeof(float), image->width, file) != image->width)
+      break;
+  }
+
+  free(row);
+  return ferror(file) ? -1 : 0;
+}
+
+PortableFloatMap* createEmptyFloatMap(size_t width, size_t height)
+{
+  PortableFloatMap* res = malloc(sizeof(PortableFloatMap));
+  if (res == NULL)
+    return NULL;
+
+  res->width = width;
+  res->height = height;
+  res->array = NULL;
+  if (width > 0 && height > SIZE_MAX / sizeof(float) / width)
+  {
+    free(res);
+    return NULL;
+  }
+
+  res->array = calloc(width * height > 0 ? width * height : 1, sizeof(float));
+  if (res->array == NULL)
+  {
+    free(res);
+    return NULL;
+  }
+
+  return res;
+}
+
+void deleteFloatMap(PortableFloatMap* image)
+{
+  if (image == NULL)
+    return;
+  free(image->array);
+  free(image);
+  return;
+}
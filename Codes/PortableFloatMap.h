@@ -0,0 +1,124 @@
+/***********************************************************************
+ * PortableFloatMap
+ * Representation of grayscale image with floating-point samples.
+ *
+ * File format specification: http://netpbm.sourceforge.net/doc/pfm.html
+ * Only grayscale images ("Pf") are supported. Their samples are 4-byte
+ * floats, little-endian if the scale of the header is negative and
+ * big-endian otherwise, the rows being stored from the bottom one to
+ * the top one.
+ ***********************************************************************/
+
+#ifndef _PORTABLE_FLOAT_MAP_H_
+#define _PORTABLE_FLOAT_MAP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Types */
+
+/* Representation of a PFM image */
+typedef struct
+{
+  size_t width;                 // Number of columns of array
+  size_t height;                // Number of rows of array
+  float* array;                 // Image of size 'height x width', stored
+                                // row after row from the top one
+} PortableFloatMap;
+
+/* Functions */
+
+/***********************************************************************
+ * Create an image from a file.
+ * The image must later be deleted by calling deleteFloatMap().
+ *
+ * PARAMETER
+ * filename     - File name of a pfm image ("-" for the standard input,
+ *                a ".gz" suffix for a gzip-compressed image)
+ *
+ * RETURN
+ * NULL         - if any error
+ * image        - The read image
+ ***********************************************************************/
+PortableFloatMap* createFloatMapFromFile(const char* filename);
+
+/***********************************************************************
+ * Create an image from the current position of a stream, which is left
+ * just after the image.
+ * The image must later be deleted by calling deleteFloatMap().
+ *
+ * PARAMETER
+ * file         - A stream opened for reading
+ *
+ * RETURN
+ * NULL         - if any error
+ * image        - The read image
+ ***********************************************************************/
+PortableFloatMap* createFloatMapFromStream(FILE* file);
+
+/***********************************************************************
+ * Create an image as createFloatMapFromStream() does, its magic number
+ * having already been read by readMagicNumber().
+ *
+ * PARAMETERS
+ * file         - A stream opened for reading
+ * kind         - The kind returned by readMagicNumber()
+ *
+ * RETURN
+ * NULL         - if any error, including a kind other than PFM
+ * image        - The read image
+ ***********************************************************************/
+PortableFloatMap* createFloatMapAfterMagic(FILE* file, int kind);
+
+/***********************************************************************
+ * Save an image to a file, with little-endian samples.
+ *
+ * PARAMETERS
+ * image        - The image to save
+ * filename     - Destination file name ("-" for the standard output,
+ *                a ".gz" suffix for a gzip-compressed image)
+ *
+ * RETURN
+ * 0            - If no error
+ * non-0        - Otherwise
+ ***********************************************************************/
+int saveFloatMapToFile(const PortableFloatMap* image, const char* filename);
+
+/***********************************************************************
+ * Write an image at the current position of a stream, with
+ * little-endian samples.
+ *
+ * PARAMETERS
+ * image        - The image to save
+ * file         - A stream opened for writing
+ *
+ * RETURN
+ * 0            - If no error
+ * non-0        - Otherwise
+ ***********************************************************************/
+int saveFloatMapToStream(const PortableFloatMap* image, FILE* file);
+
+/***********************************************************************
+ * Create an empty image of specified dimension.
+ * The image must later be deleted by calling deleteFloatMap().
+ *
+ * PARAMETERS
+ * width        - The width of the image
+ * height       - The height of the image
+ *
+ * RETURN
+ * NULL         - if any error
+ * image        - A new image where each sample is initialized to 0
+ ***********************************************************************/
+PortableFloatMap* createEmptyFloatMap(size_t width, size_t height);
+
+/***********************************************************************
+ * Delete an image.
+ *
+ * PARAMETER
+ * image        - The image to destroy.
+ ***********************************************************************/
+void deleteFloatMap(PortableFloatMap* image);
+
+#endif // !_PORTABLE_FLOAT_MAP_H_
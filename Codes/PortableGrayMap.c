@@ -11,132 +11,486 @@
 #include <string.h>
 #include <inttypes.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "PortableGrayMap.h"
 
-PortableGrayMap* createImageFromFile(const char* filename)
+/*
+ * Names ending with ".gz" are gzip-compressed files, (de)compressed by a
+ * thread of their own behind a socket pair, so that the codec runs while
+ * the images are parsed and quantized. Building with -DNO_ZLIB removes
+ * zlib, such files being then refused.
+ */
+#ifndef NO_ZLIB
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Bytes moved at once between zlib and the image stream
+#define CODEC_CHUNK 65536
+
+/* A compressed file, behind the stream given to the caller */
+typedef struct CodecStream
 {
-  FILE* file = fopen(filename, "r");
-  if(!file)
+  FILE* file;                   // Image stream of the caller
+  gzFile archive;               // The compressed file
+  int socket;                   // End of the socket pair used by the thread
+  int status;                   // 0 if the thread met no error
+  pthread_t thread;
+  struct CodecStream* next;
+} CodecStream;
+
+// Compressed files opened and not closed yet
+static CodecStream* openStreams = NULL;
+static pthread_mutex_t openStreamsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/***********************************************************************
+ * Body of the thread decompressing a file into the image stream. The
+ * reader may close the stream before its end, the remaining bytes being
+ * then dropped.
+ ***********************************************************************/
+static void* decompressStream(void* arg)
+{
+  CodecStream* stream = arg;
+  unsigned char buffer[CODEC_CHUNK];
+  int nRead;
+  while ((nRead = gzread(stream->archive, buffer, sizeof(buffer))) > 0)
+  {
+    int nSent = 0;
+    while (nSent < nRead)
+    {
+      ssize_t n = send(stream->socket, buffer + nSent,
+                       (size_t)(nRead - nSent), MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      nSent += (int)n;
+    }
+    if (nSent < nRead)
+      break;
+  }
+  if (nRead < 0)
+    stream->status = -1;
+  gzclose(stream->archive);
+  close(stream->socket);
+  return NULL;
+}
+
+/***********************************************************************
+ * Body of the thread compressing the image stream into a file. After an
+ * error, the stream is still drained, so that the writer never blocks.
+ ***********************************************************************/
+static void* compressStream(void* arg)
+{
+  CodecStream* stream = arg;
+  unsigned char buffer[CODEC_CHUNK];
+  ssize_t nRead;
+  while ((nRead = recv(stream->socket, buffer, sizeof(buffer), 0)) != 0)
+  {
+    if (nRead < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      stream->status = -1;
+      break;
+    }
+    if (stream->status == 0 &&
+        gzwrite(stream->archive, buffer, (unsigned)nRead) != nRead)
+      stream->status = -1;
+  }
+  if (gzclose(stream->archive) != Z_OK)
+    stream->status = -1;
+  close(stream->socket);
+  return NULL;
+}
+
+/***********************************************************************
+ * Open a compressed file as a stream, whose codec thread is started.
+ ***********************************************************************/
+static FILE* openCodecStream(const char* filename, bool writing)
+{
+  CodecStream* stream = malloc(sizeof(CodecStream));
+  if (stream == NULL)
     return NULL;
 
-  // File encoding
-  char magicNumber[3];
-  if (fscanf(file, "%2s", magicNumber) != 1)
+  int sockets[2];
+  stream->archive = gzopen(filename, writing ? "wb" : "rb");
+  if (stream->archive == NULL)
+  {
+    free(stream);
+    return NULL;
+  }
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
   {
-    fclose(file);
+    gzclose(stream->archive);
+    free(stream);
     return NULL;
   }
 
-  PortableGrayMapType type;
-  if (strcmp(magicNumber, "P2") == 0)
-    type = ASCII;
-  else if (strcmp(magicNumber, "P5") == 0)
-    type = BINARY;
-  else
+  stream->socket = sockets[1];
+  stream->status = 0;
+  stream->file = fdopen(sockets[0], writing ? "wb" : "rb");
+  if (stream->file == NULL ||
+      pthread_create(&stream->thread, NULL,
+                     writing ? compressStream : decompressStream,
+                     stream) != 0)
   {
-    fclose(file);
+    if (stream->file != NULL)
+      fclose(stream->file);
+    else
+      close(sockets[0]);
+    close(sockets[1]);
+    gzclose(stream->archive);
+    free(stream);
     return NULL;
   }
 
-  // Skip comments
-  char nextChar = fgetc(file);
+  pthread_mutex_lock(&openStreamsMutex);
+  stream->next = openStreams;
+  openStreams = stream;
+  pthread_mutex_unlock(&openStreamsMutex);
+  return stream->file;
+}
+
+/***********************************************************************
+ * Close a stream opened by openCodecStream, waiting for its thread.
+ * Returns 1 if the stream is not a compressed one, 0 if no error and -1
+ * otherwise.
+ ***********************************************************************/
+static int closeCodecStream(FILE* file)
+{
+  pthread_mutex_lock(&openStreamsMutex);
+  CodecStream** link = &openStreams;
+  while (*link != NULL && (*link)->file != file)
+    link = &(*link)->next;
+  CodecStream* stream = *link;
+  if (stream != NULL)
+    *link = stream->next;
+  pthread_mutex_unlock(&openStreamsMutex);
+  if (stream == NULL)
+    return 1;
+
+  // The end of the stream stops the thread
+  int failed = fclose(file) != 0;
+  pthread_join(stream->thread, NULL);
+  failed |= stream->status != 0;
+  free(stream);
+  return failed ? -1 : 0;
+}
+#endif
+
+/***********************************************************************
+ * Tell whether a file name ends with ".gz".
+ ***********************************************************************/
+static bool isCompressedName(const char* filename)
+{
+  const size_t length = strlen(filename);
+  return length >= 3 && strcmp(filename + length - 3, ".gz") == 0;
+}
+
+// Samples byte-swapped at once, on the SIMD registers if any
+#if defined(__GNUC__) || defined(__clang__)
+#define SWAP_LANES 8
+typedef uint16_t SampleLanes __attribute__((vector_size(2 * SWAP_LANES)));
+#endif
+
+/***********************************************************************
+ * Convert 2-byte samples, in place, between the big-endian order of the
+ * binary files and the order of the host: on little-endian hosts, the
+ * two bytes of each sample are swapped, SWAP_LANES samples at a time.
+ ***********************************************************************/
+static void swapSampleBytes(uint16_t* samples, size_t length)
+{
+  const uint16_t probe = 1;
+  if (*(const unsigned char*)&probe == 0)
+    return;
+
+  size_t j = 0;
+#ifdef SWAP_LANES
+  for (; j + SWAP_LANES <= length; j += SWAP_LANES)
+  {
+    SampleLanes lanes;
+    memcpy(&lanes, samples + j, sizeof(lanes));
+    lanes = (lanes << 8) | (lanes >> 8);
+    memcpy(samples + j, &lanes, sizeof(lanes));
+  }
+#endif
+  for (; j < length; ++j)
+    samples[j] = (uint16_t)(samples[j] << 8 | samples[j] >> 8);
+}
+
+int readHeaderValue(FILE* file, unsigned long* value)
+{
+  int nextChar = fgetc(file);
   while (nextChar != EOF && !isdigit(nextChar))
+  {
+    if (nextChar == '#')
+      while (nextChar != EOF && nextChar != '\n')
+        nextChar = fgetc(file);
+    else if (!isspace(nextChar))
+      return -1;
     nextChar = fgetc(file);
-  fseek(file, -1, SEEK_CUR);
+  }
+  if (nextChar == EOF)
+    return -1;
 
-  // read width
-  size_t width = 0;
-  if (fscanf(file, "%lu", &width) != 1)
+  *value = 0;
+  while (isdigit(nextChar))
   {
-    fclose(file);
-    return NULL;
+    const unsigned long digit = (unsigned long)(nextChar - '0');
+    if (*value > (ULONG_MAX - digit) / 10)
+      return -1;
+    *value = *value * 10 + digit;
+    nextChar = fgetc(file);
   }
+  return 0;
+}
 
-  // read height
-  size_t height = 0;
-  if (fscanf(file, "%lu", &height) != 1)
+FILE* openImageFile(const char* filename, bool writing)
+{
+  if (filename == NULL)
+    return NULL;
+  if (strcmp(filename, "-") == 0)
+    return writing ? stdout : stdin;
+  if (isCompressedName(filename))
   {
-    fclose(file);
+#ifndef NO_ZLIB
+    return openCodecStream(filename, writing);
+#else
     return NULL;
+#endif
   }
+  return fopen(filename, writing ? "wb" : "rb");
+}
+
+int closeImageFile(FILE* file)
+{
+  if (file == NULL)
+    return -1;
+  if (file == stdin)
+    return 0;
+  if (file == stdout)
+    return fflush(stdout) != 0 ? -1 : 0;
+#ifndef NO_ZLIB
+  const int closed = closeCodecStream(file);
+  if (closed != 1)
+    return closed;
+#endif
+  return fclose(file) != 0 ? -1 : 0;
+}
 
-  // read max value
-  uint16_t maxValue = 0;
-  if (fscanf(file, "%" SCNu16, &maxValue) != 1)
+PortableGrayMap* createImageFromFile(const char* filename)
+{
+  FILE* file = openImageFile(filename, false);
+  if(!file)
+    return NULL;
+
+  // A corrupted compressed file may only be noticed at its end
+  PortableGrayMap* res = createImageFromStream(file);
+  if (closeImageFile(file) != 0)
   {
-    fclose(file);
+    deleteImage(res);
     return NULL;
   }
+  return res;
+}
+
+PortableGrayMap* createImageFromStream(FILE* file)
+{
+  if (file == NULL)
+    return NULL;
+  return createImageAfterMagic(file, readMagicNumber(file));
+}
+
+int readMagicNumber(FILE* file)
+{
+  if (file == NULL || fgetc(file) != 'P')
+    return -1;
+  return fgetc(file);
+}
+
+PortableGrayMap* createImageAfterMagic(FILE* file, int kind)
+{
+  PortableGrayMap header;
+  if (readImageHeader(file, kind, &header) != 0)
+    return NULL;
 
   // create image
-  PortableGrayMap* res = createEmptyImage(width, height, maxValue);
+  PortableGrayMap* res = createEmptyImage(header.width, header.height,
+                                          header.maxValue);
   if (res == NULL)
-  {
-    fclose(file);
     return NULL;
-  }
-  res->type = type;
-
-  // skip space in binary format
-  if (res->type == BINARY)
-    fgetc(file);
+  res->type = header.type;
 
   // fill image
   for (size_t i = 0; i < res->height; ++i)
-    for (size_t j = 0; j < res->width; ++j)
+  {
+    if (readImageRow(file, &header, res->array[i]) != 0)
+    {
+      deleteImage(res);
+      return NULL;
+    }
+  }
+  return res;
+}
+
+int readImageHeader(FILE* file, int kind, PortableGrayMap* header)
+{
+  if (file == NULL || header == NULL)
+    return -1;
+
+  // File encoding
+  switch (kind)
+  {
+    case '2':
+      header->type = ASCII;
+      break;
+    case '5':
+      header->type = BINARY;
+      break;
+    default:
+      return -1;
+  }
+
+  // read width, height and max value
+  unsigned long width = 0, height = 0, maxValue = 0;
+  if (readHeaderValue(file, &width) != 0 ||
+      readHeaderValue(file, &height) != 0 ||
+      readHeaderValue(file, &maxValue) != 0 ||
+      maxValue == 0 || maxValue > UINT16_MAX)
+    return -1;
+
+  header->width = width;
+  header->height = height;
+  header->maxValue = (uint16_t)maxValue;
+  header->array = NULL;
+  return 0;
+}
+
+int readImageRow(FILE* file, const PortableGrayMap* header, uint16_t* row)
+{
+  if (file == NULL || header == NULL || row == NULL)
+    return -1;
+
+  if (header->type == ASCII)
+  {
+    for (size_t j = 0; j < header->width; ++j)
     {
       int value = -1;
-      if (res->type == BINARY)
-        value = fgetc(file);
-      else
-        fscanf(file, "%d", &value);
-
-      if (value < 0)
-      {
-        deleteImage(res);
-        fclose(file);
-        return NULL;
-      }
-      res->array[i][j] = (uint16_t)value;
+      if (fscanf(file, "%d", &value) != 1 || value < 0 ||
+          value > header->maxValue)
+        return -1;
+      row[j] = (uint16_t)value;
     }
+    return 0;
+  }
 
-  fclose(file);
-  return res;
+  // Binary samples are stored on 2 bytes (MSB first) if maxValue > 255,
+  // 1-byte samples being read at the start of the row, then widened from
+  // its end so that none is overwritten before being read
+  const bool wide = header->maxValue > 255;
+  if (wide)
+  {
+    if (fread(row, 2, header->width, file) != header->width)
+      return -1;
+    swapSampleBytes(row, header->width);
+  }
+  else
+  {
+    const unsigned char* bytes = (const unsigned char*)row;
+    if (fread(row, 1, header->width, file) != header->width)
+      return -1;
+    for (size_t j = header->width; j-- > 0;)
+      row[j] = bytes[j];
+  }
+
+  uint16_t largest = 0;
+  for (size_t j = 0; j < header->width; ++j)
+    largest = row[j] > largest ? row[j] : largest;
+  return largest > header->maxValue ? -1 : 0;
+}
+
+bool isEndOfStream(FILE* file)
+{
+  if (file == NULL)
+    return true;
+
+  // Images may be separated by white spaces
+  int nextChar = fgetc(file);
+  while (nextChar != EOF && isspace(nextChar))
+    nextChar = fgetc(file);
+  if (nextChar == EOF)
+    return true;
+  ungetc(nextChar, file);
+  return false;
 }
 
 int saveImageToFile(const PortableGrayMap* image, const char* filename)
 {
-  if (image == NULL)
+  if (image == NULL || filename == NULL)
     return -1;
 
-  FILE* file = fopen(filename, "w");
+  FILE* file = openImageFile(filename, true);
   if (file == NULL)
   {
     return -1;
   }
 
+  int failed = saveImageToStream(image, file);
+  if (closeImageFile(file) != 0 || failed)
+    return -1;
+  return 0;
+}
+
+int saveImageToStream(const PortableGrayMap* image, FILE* file)
+{
+  if (image == NULL || file == NULL)
+    return -1;
+
   fprintf(file, image->type == BINARY ? "P5\n" : "P2\n");
   fprintf(file, "%lu %lu\n", image->width, image->height);
   fprintf(file, "%u\n", image->maxValue);
 
-  for (size_t i = 0; i < image->height; ++i)
+  if (image->type == ASCII)
   {
-    for (size_t j = 0; j < image->width; ++j)
+    for (size_t i = 0; i < image->height; ++i)
     {
-      if (image->type == BINARY)
-        image->maxValue > 256 ? fputc((uint16_t)image->array[i][j], file)
-                              : fputc((uint8_t)image->array[i][j], file);
-      else
+      for (size_t j = 0; j < image->width; ++j)
         fprintf(file, "%u ", image->array[i][j]);
+      fprintf(file, "\n");
     }
+    return ferror(file) ? -1 : 0;
+  }
 
-    if (image->type == ASCII)
-      fprintf(file, "\n");
+  // Binary rows are converted in a buffer, then written at once
+  const bool wide = image->maxValue > 255;
+  void* buffer = malloc(image->width * (wide ? 2 : 1));
+  if (buffer == NULL && image->width > 0)
+    return -1;
+
+  for (size_t i = 0; i < image->height; ++i)
+  {
+    const uint16_t* row = image->array[i];
+    if (wide)
+    {
+      memcpy(buffer, row, image->width * sizeof(uint16_t));
+      swapSampleBytes(buffer, image->width);
+    }
+    else
+    {
+      unsigned char* bytes = buffer;
+      for (size_t j = 0; j < image->width; ++j)
+        bytes[j] = (unsigned char)row[j];
+    }
+    if (fwrite(buffer, wide ? 2 : 1, image->width, file) != image->width)
+      break;
   }
 
-  fclose(file);
-  return 0;
+  free(buffer);
+  return ferror(file) ? -1 : 0;
 }
 
 PortableGrayMap* createEmptyImage(size_t width, size_t height, size_t numLevels)
@@ -3,13 +3,17 @@
  * Representation of grayscale image.
  *
  * File format specification: http://netpbm.sourceforge.net/doc/pgm.html
+ * Binary (P5) samples take 2 bytes, most significant first, when
+ * maxValue > 255, and 1 byte otherwise.
  ***********************************************************************/
 
 #ifndef _PORTABLE_GRAY_MAP_H_
 #define _PORTABLE_GRAY_MAP_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 /* Types */
 
@@ -32,12 +36,58 @@ typedef struct
 
 /* Functions */
 
+/***********************************************************************
+ * Open a file holding images. The name "-" stands for the standard
+ * input or output, and names ending with ".gz" for gzip-compressed
+ * files, (de)compressed on a thread of their own while the stream is
+ * read or written.
+ * The stream must later be closed by calling closeImageFile().
+ *
+ * PARAMETERS
+ * filename     - The name of the file
+ * writing      - Whether the file is written, or read
+ *
+ * RETURN
+ * NULL         - if any error
+ * file         - A stream over the uncompressed images
+ ***********************************************************************/
+FILE* openImageFile(const char* filename, bool writing);
+
+/***********************************************************************
+ * Close a stream opened by openImageFile(), flushing the standard output
+ * and waiting for the end of the compression of a gzip-compressed file.
+ *
+ * PARAMETER
+ * file         - The stream to close
+ *
+ * RETURN
+ * 0            - If no error
+ * non-0        - Otherwise, including a corrupted compressed file
+ ***********************************************************************/
+int closeImageFile(FILE* file);
+
+/***********************************************************************
+ * Read an unsigned decimal value of a netpbm header, skipping the white
+ * spaces and comments before it. The single white space ending the
+ * value is consumed, so that the stream never has to be rewound.
+ *
+ * PARAMETERS
+ * file         - A stream positioned in a header
+ * value        - A pointer where the value is stored
+ *
+ * RETURN
+ * 0            - If no error
+ * non-0        - Otherwise, including a value above ULONG_MAX
+ ***********************************************************************/
+int readHeaderValue(FILE* file, unsigned long* value);
+
 /***********************************************************************
  * Create an image from a file.
  * The image must later be deleted by calling deleteImage().
  *
  * PARAMETER
- * filename     - File name of a pgm image
+ * filename     - File name of a pgm image ("-" for the standard input,
+ *                a ".gz" suffix for a gzip-compressed image)
  *
  * RETURN
  * NULL         - if any error
@@ -45,12 +95,103 @@ typedef struct
  ***********************************************************************/
 PortableGrayMap* createImageFromFile(const char* filename);
 
+/***********************************************************************
+ * Create an image from the current position of a stream, which is left
+ * just after the image. The stream is never rewound, so that pipes are
+ * supported and several images can be read back to back.
+ * The image must later be deleted by calling deleteImage().
+ *
+ * PARAMETER
+ * file         - A stream opened for reading
+ *
+ * RETURN
+ * NULL         - if any error
+ * image        - The read image
+ ***********************************************************************/
+PortableGrayMap* createImageFromStream(FILE* file);
+
+/***********************************************************************
+ * Read the magic number of the next image of a stream, "P" followed by
+ * a character telling the kind of the image, so that the reader of
+ * this kind can be chosen without rewinding the stream.
+ *
+ * PARAMETER
+ * file         - A stream opened for reading
+ *
+ * RETURN
+ * -1           - If the stream does not go on with "P"
+ * kind         - The character following "P" ('2' or '5' for a PGM
+ *                image, '3' or '6' for a PPM one, 'f' for a PFM one)
+ ***********************************************************************/
+int readMagicNumber(FILE* file);
+
+/***********************************************************************
+ * Create an image as createImageFromStream() does, its magic number
+ * having already been read by readMagicNumber().
+ *
+ * PARAMETERS
+ * file         - A stream opened for reading
+ * kind         - The kind returned by readMagicNumber()
+ *
+ * RETURN
+ * NULL         - if any error, including a kind other than PGM
+ * image        - The read image
+ ***********************************************************************/
+PortableGrayMap* createImageAfterMagic(FILE* file, int kind);
+
+/***********************************************************************
+ * Read the header of a PGM image, its magic number having already been
+ * read by readMagicNumber(), so that its rows can then be read one at a
+ * time by readImageRow() without holding the whole image.
+ *
+ * PARAMETERS
+ * file         - A stream opened for reading
+ * kind         - The kind returned by readMagicNumber()
+ * header       - A pointer where the type, the size and the max value
+ *                of the image are stored, its array being set to NULL
+ *
+ * RETURN
+ * 0            - If no error
+ * non-0        - Otherwise, including a kind other than PGM
+ ***********************************************************************/
+int readImageHeader(FILE* file, int kind, PortableGrayMap* header);
+
+/***********************************************************************
+ * Read the next row of an image whose header was read by
+ * readImageHeader(), checking that no sample exceeds its max value.
+ *
+ * PARAMETERS
+ * file         - A stream positioned at the start of a row
+ * header       - The header of the image
+ * row          - A vector of header->width values who will contain the
+ *                samples of the row
+ *
+ * RETURN
+ * 0            - If no error
+ * non-0        - Otherwise
+ ***********************************************************************/
+int readImageRow(FILE* file, const PortableGrayMap* header, uint16_t* row);
+
+/***********************************************************************
+ * Tell whether a stream holds no more image, skipping the white spaces
+ * that may separate two images.
+ *
+ * PARAMETER
+ * file         - A stream opened for reading
+ *
+ * RETURN
+ * true         - If the end of the stream is reached
+ * false        - If another image (or garbage) follows
+ ***********************************************************************/
+bool isEndOfStream(FILE* file);
+
 /***********************************************************************
  * Save an image to a file.
  *
  * PARAMETERS
  * image        - The image to save
- * filename     - Destination file name
+ * filename     - Destination file name ("-" for the standard output,
+ *                a ".gz" suffix for a gzip-compressed image)
  *
  * RETURN
  * 0            - If no error
@@ -58,6 +199,20 @@ PortableGrayMap* createImageFromFile(const char* filename);
  ***********************************************************************/
 int saveImageToFile(const PortableGrayMap* image, const char* filename);
 
+/***********************************************************************
+ * Write an image at the current position of a stream, so that several
+ * images can be written back to back.
+ *
+ * PARAMETERS
+ * image        - The image to save
+ * file         - A stream opened for writing
+ *
+ * RETURN
+ * 0            - If no error
+ * non-0        - Otherwise
+ ***********************************************************************/
+int saveImageToStream(const PortableGrayMap* image, FILE* file);
+
 /***********************************************************************
  * Create an empty image of specified dimension.
  * The image must later be deleted by calling deleteImage().
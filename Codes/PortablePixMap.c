@@ -0,0 +1,225 @@
+/***********************************************************************
+ * PortablePixMap
+ * Implementation of the interface PortablePixMap.h
+ *
+ * Documentation about the PPM format can be found at
+ * http://netpbm.sourceforge.net/doc/ppm.html
+ ************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "PortablePixMap.h"
+#include "PortableGrayMap.h"
+
+PortablePixMap* createPixMapFromFile(const char* filename)
+{
+  FILE* file = openImageFile(filename, false);
+  if (!file)
+    return NULL;
+
+  // A corrupted compressed file may only be noticed at its end
+  PortablePixMap* res = createPixMapFromStream(file);
+  if (closeImageFile(file) != 0)
+  {
+    deletePixMap(res);
+    return NULL;
+  }
+  return res;
+}
+
+PortablePixMap* createPixMapFromStream(FILE* file)
+{
+  if (file == NULL)
+    return NULL;
+  return createPixMapAfterMagic(file, readMagicNumber(file));
+}
+
+PortablePixMap* createPixMapAfterMagic(FILE* file, int kind)
+{
+  if (file == NULL)
+    return NULL;
+
+  // File encoding
+  PortablePixMapType type;
+  switch (kind)
+  {
+    case '3':
+      type = PIXMAP_ASCII;
+      break;
+    case '6':
+      type = PIXMAP_BINARY;
+      break;
+    default:
+      return NULL;
+  }
+
+  // read width, height and max value
+  unsigned long width = 0, height = 0, maxValue = 0;
+  if (readHeaderValue(file, &width) != 0 ||
+      readHeaderValue(file, &height) != 0 ||
+      readHeaderValue(file, &maxValue) != 0 ||
+      maxValue == 0 || maxValue > UINT16_MAX)
+    return NULL;
+
+  // create image
+  PortablePixMap* res = createEmptyPixMap(width, height, maxValue);
+  if (res == NULL)
+    return NULL;
+  res->type = type;
+
+  // fill image, samples being stored on 2 bytes (MSB first) if needed
+  const size_t rowLength = 3 * res->width;
+  const size_t sampleSize = res->maxValue > 255 ? 2 : 1;
+  unsigned char* row = NULL;
+  if (res->type == PIXMAP_BINARY)
+  {
+    row = malloc(rowLength * sampleSize);
+    if (row == NULL && rowLength > 0)
+    {
+      deletePixMap(res);
+      return NULL;
+    }
+  }
+
+  for (size_t i = 0; i < res->height; ++i)
+  {
+    if (res->type == PIXMAP_BINARY)
+    {
+      if (fread(row, sampleSize, rowLength, file) != rowLength)
+      {
+        free(row);
+        deletePixMap(res);
+        return NULL;
+      }
+      uint16_t largest = 0;
+      for (size_t j = 0; j < rowLength; ++j)
+      {
+        uint16_t value = sampleSize == 2
+                       ? (uint16_t)(row[2 * j] << 8 | row[2 * j + 1])
+                       : row[j];
+        res->array[i][j] = value;
+        largest = value > largest ? value : largest;
+      }
+      if (largest > res->maxValue)
+      {
+        free(row);
+        deletePixMap(res);
+        return NULL;
+      }
+    }
+    else
+    {
+      for (size_t j = 0; j < rowLength; ++j)
+      {
+        unsigned int value;
+        if (fscanf(file, "%u", &value) != 1 || value > res->maxValue)
+        {
+          free(row);
+          deletePixMap(res);
+          return NULL;
+        }
+        res->array[i][j] = (uint16_t)value;
+      }
+    }
+  }
+
+  free(row);
+  return res;
+}
+
+int savePixMapToFile(const PortablePixMap* image, const char* filename)
+{
+  if (image == NULL || filename == NULL)
+    return -1;
+
+  FILE* file = openImageFile(filename, true);
+  if (file == NULL)
+  {
+    return -1;
+  }
+
+  int failed = savePixMapToStream(image, file);
+  if (closeImageFile(file) != 0 || failed)
+    return -1;
+  return 0;
+}
+
+int savePixMapToStream(const PortablePixMap* image, FILE* file)
+{
+  if (image == NULL || file == NULL)
+    return -1;
+
+  fprintf(file, image->type == PIXMAP_BINARY ? "P6\n" : "P3\n");
+  fprintf(file, "%zu %zu\n", image->width, image->height);
+  fprintf(file, "%u\n", image->maxValue);
+
+  const size_t rowLength = 3 * image->width;
+  const size_t sampleSize = image->maxValue > 255 ? 2 : 1;
+  for (size_t i = 0; i < image->height; ++i)
+  {
+    for (size_t j = 0; j < rowLength; ++j)
+    {
+      if (image->type == PIXMAP_BINARY)
+      {
+        if (sampleSize == 2)
+          fputc(image->array[i][j] >> 8, file);
+        fputc(image->array[i][j] & 0xFF, file);
+      }
+      else
+        fprintf(file, "%u ", image->array[i][j]);
+    }
+
+    if (image->type == PIXMAP_ASCII)
+      fprintf(file, "\n");
+  }
+
+  return ferror(file) ? -1 : 0;
+}
+
+PortablePixMap* createEmptyPixMap(size_t width, size_t height,
+                                  uint16_t maxValue)
+{
+  PortablePixMap* res = malloc(sizeof(PortablePixMap));
+  if (res == NULL)
+    return NULL;
+
+  res->type = PIXMAP_ASCII;
+  res->width = width;
+  res->height = height;
+  res->maxValue = maxValue;
+
+  res->array = malloc(height * sizeof(uint16_t*));
+  if (res->array == NULL)
+  {
+    free(res);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < height; ++i)
+  {
+    res->array[i] = calloc(3 * width, sizeof(uint16_t));
+    if (res->array[i] == NULL)
+    {
+      for (size_t j = 0; j < i; ++j)
+        free(res->array[j]);
+      free(res->array);
+      free(res);
+      return NULL;
+    }
+  }
+
+  return res;
+}
+
+void deletePixMap(PortablePixMap* image)
+{
+  if (image == NULL)
+    return;
+  for (size_t i = 0; i < image->height; ++i)
+    free(image->array[i]);
+  free(image->array);
+  free(image);
+  return;
+}
@@ -0,0 +1,132 @@
+/***********************************************************************
+ * PortablePixMap
+ * Representation of colour image.
+ *
+ * File format specification: http://netpbm.sourceforge.net/doc/ppm.html
+ ***********************************************************************/
+
+#ifndef _PORTABLE_PIX_MAP_H_
+#define _PORTABLE_PIX_MAP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Types */
+
+/* File encoding of an image */
+typedef enum
+{
+  PIXMAP_ASCII = 3,
+  PIXMAP_BINARY = 6
+} PortablePixMapType;
+
+/* Representation of a PPM image */
+typedef struct
+{
+  PortablePixMapType type;      // Encoding format (ASCII or BINARY)
+  size_t width;                 // Number of columns of array
+  size_t height;                // Number of rows of array
+  uint16_t maxValue;            // Maximum channel value (do not edit)
+  uint16_t** array;             // Image of size 'height x 3 * width',
+                                // each pixel being stored as R, G, B
+} PortablePixMap;
+
+/* Functions */
+
+/***********************************************************************
+ * Create an image from a file.
+ * The image must later be deleted by calling deletePixMap().
+ *
+ * PARAMETER
+ * filename     - File name of a ppm image ("-" for the standard input,
+ *                a ".gz" suffix for a gzip-compressed image)
+ *
+ * RETURN
+ * NULL         - if any error
+ * image        - The read image
+ ***********************************************************************/
+PortablePixMap* createPixMapFromFile(const char* filename);
+
+/***********************************************************************
+ * Create an image from the current position of a stream, which is left
+ * just after the image, without rewinding it.
+ * The image must later be deleted by calling deletePixMap().
+ *
+ * PARAMETER
+ * file         - A stream opened for reading
+ *
+ * RETURN
+ * NULL         - if any error
+ * image        - The read image
+ ***********************************************************************/
+PortablePixMap* createPixMapFromStream(FILE* file);
+
+/***********************************************************************
+ * Create an image as createPixMapFromStream() does, its magic number
+ * having already been read by readMagicNumber().
+ *
+ * PARAMETERS
+ * file         - A stream opened for reading
+ * kind         - The kind returned by readMagicNumber()
+ *
+ * RETURN
+ * NULL         - if any error, including a kind other than PPM
+ * image        - The read image
+ ***********************************************************************/
+PortablePixMap* createPixMapAfterMagic(FILE* file, int kind);
+
+/***********************************************************************
+ * Save an image to a file.
+ *
+ * PARAMETERS
+ * image        - The image to save
+ * filename     - Destination file name ("-" for the standard output,
+ *                a ".gz" suffix for a gzip-compressed image)
+ *
+ * RETURN
+ * 0            - If no error
+ * non-0        - Otherwise
+ ***********************************************************************/
+int savePixMapToFile(const PortablePixMap* image, const char* filename);
+
+/***********************************************************************
+ * Write an image at the current position of a stream, so that several
+ * images can be written back to back.
+ *
+ * PARAMETERS
+ * image        - The image to save
+ * file         - A stream opened for writing
+ *
+ * RETURN
+ * 0            - If no error
+ * non-0        - Otherwise
+ ***********************************************************************/
+int savePixMapToStream(const PortablePixMap* image, FILE* file);
+
+/***********************************************************************
+ * Create an empty image of specified dimension.
+ * The image must later be deleted by calling deletePixMap().
+ *
+ * PARAMETERS
+ * width        - The width of the image
+ * height       - The height of the image
+ * maxValue     - Maximum value of a channel
+ *
+ * RETURN
+ * NULL         - if any error
+ * image        - A new image where each channel is initialized to 0
+ ***********************************************************************/
+PortablePixMap* createEmptyPixMap(size_t width, size_t height,
+                                  uint16_t maxValue);
+
+/***********************************************************************
+ * Delete an image.
+ *
+ * PARAMETER
+ * image        - The image to destroy.
+ ***********************************************************************/
+void deletePixMap(PortablePixMap* image);
+
+#endif // !_PORTABLE_PIX_MAP_H_
@@ -7,15 +7,19 @@
 #define _REDUCTION_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "ReductionSettings.h"
+
 
 /***********************************************************************
  * Given an histogram h of size n, where n is the number of gray levels,
  * this function computes k thresholds (p_1, ..., p_{k-1}, p_k = n) and
  * k levels (v_1, ... v_k), with k <= n, such that the resulting mapping
  * function g(i) (tries to) minimize(s) the squared error
- * \sum_{i=0}^{n-1} h[i](i-g(i))^2.
+ * \sum_{i=0}^{n-1} h[i](i-g(i))^2,
+ * with the default settings of ReductionSettings.h.
  *
  * PARAMETERS
  * histogram          The histogram vector (h)
@@ -32,5 +36,32 @@
 bool computeReduction(const size_t* histogram, size_t histogramLength,
                       size_t nLevels, size_t* thresholds, uint16_t* levels);
 
+/***********************************************************************
+ * Compute a reduction as computeReduction does, with explicit tuning
+ * parameters, and report on it. A reduction supporting them instead
+ * minimizes \sum_{i=0}^{n-1} w[i]h[i]d(i, g(i)), with d the squared or
+ * absolute difference and w the weights of the gray levels.
+ *
+ * PARAMETERS
+ * histogram          The histogram vector (h)
+ * histogramLength    Size of the histogram vector (n)
+ * nLevels            The number of levels after compression (k)
+ * thresholds         An allocated vector of size k where the computed
+ *                    thresholds (p_1, ..., p_k) will be stored
+ * levels             An allocated vector of size k where the computed levels
+ *                    (v_1, ..., v_k) will be stored
+ * settings           The tuning parameters (NULL for the defaults)
+ * report             A pointer where the report of the reduction is stored
+ *                    (NULL if not needed)
+ *
+ * RETURN
+ * wentFine           A boolean stating whether no error occured
+ ***********************************************************************/
+bool computeReductionWithSettings(const size_t* histogram,
+                                  size_t histogramLength, size_t nLevels,
+                                  size_t* thresholds, uint16_t* levels,
+                                  const ReductionSettings* settings,
+                                  ReductionReport* report);
+
 #endif // !_REDUCTION_H_
 
@@ -0,0 +1,33 @@
+/***********************************************************************
+ * ReductionMoments
+ * Implementation of the interface ReductionMoments.h
+ ***********************************************************************/
+
+#include "ReductionMoments.h"
+
+bool computeMoments(const size_t* histogram, size_t histogramLength,
+                    size_t length, const size_t* weights,
+                    size_t weightsLength, uint64_t* count, uint64_t* sum,
+                    uint64_t* squares)
+{
+    count[0] = sum[0] = squares[0] = 0;
+    for(size_t l = 0; l < length; l++){
+        uint64_t h = l < histogramLength ? histogram[l] : 0;
+        if(weights && l < weightsLength){
+            if(weights[l] > 0 && h > MOMENT_LIMIT/weights[l]){
+                return false;
+            }
+            h *= weights[l];
+        }
+
+        //l <= l^2, so that the sums are bounded by the squares
+        if(h > MOMENT_LIMIT - count[l] ||
+           (l > 0 && h > (MOMENT_LIMIT - squares[l])/((uint64_t)l*l))){
+            return false;
+        }
+        count[l+1] = count[l] + h;
+        sum[l+1] = sum[l] + h*l;
+        squares[l+1] = squares[l] + h*l*l;
+    }
+    return true;
+}
@@ -0,0 +1,173 @@
+/***********************************************************************
+ * ReductionMoments
+ * Prefix moments of a histogram and errors of its intervals, shared by
+ * the reductions minimizing the error exactly (DPReduction.c and
+ * LagrangianReduction.c).
+ *
+ * The interval errors are defined here, inline, since the reductions
+ * evaluate them in their innermost loops.
+ ***********************************************************************/
+
+#ifndef _REDUCTION_MOMENTS_H_
+#define _REDUCTION_MOMENTS_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ReductionSettings.h"
+
+/*
+ * Largest moment accepted: the error of an interval, for either metric,
+ * is then at most the sum of the squares, and the sum of three of them
+ * still fits in an int64_t.
+ */
+#define MOMENT_LIMIT (UINT64_C(1) << 61)
+
+/***********************************************************************
+ * Compute the prefix moments of an histogram weighted by w, such that
+ * the sums over the gray levels [0, i) of w[l]h[l], l*w[l]h[l] and
+ * l^2*w[l]h[l] are respectively stored at index i of count, sum and
+ * squares.
+ *
+ * PARAMETERS
+ * histogram          The histogram of the image to treat
+ * histogramLength    The length of histogram (n)
+ * length             The number of bins to consider (>= n), the bins
+ *                    above n being empty
+ * weights            The weights of the gray levels (NULL: all 1)
+ * weightsLength      The size of weights, the other levels weighing 1
+ * count              An allocated vector of size length+1
+ * sum                An allocated vector of size length+1
+ * squares            An allocated vector of size length+1
+ *
+ * RETURN
+ * wentFine           false if a moment exceeds MOMENT_LIMIT, the
+ *                    weights being too large for the histogram
+ ***********************************************************************/
+bool computeMoments(const size_t* histogram, size_t histogramLength,
+                    size_t length, const size_t* weights,
+                    size_t weightsLength, uint64_t* count, uint64_t* sum,
+                    uint64_t* squares);
+
+/***********************************************************************
+ * Define the minimal squared error made by the replacement of the gray
+ * levels of a sub-histogram by a single level, in O(1) thanks to the
+ * prefix moments.
+ *
+ * PARAMETERS
+ * count, sum, squares  The prefix moments of the histogram
+ * i                  The beginning of the sub-histogram
+ * j                  The end (excluded) of the sub-histogram (i < j)
+ * level              A pointer to a value who will contain the best
+ *                    level, or NULL
+ *
+ * RETURN
+ * errorMin           The minimal error commited
+ ***********************************************************************/
+static inline int64_t defineMinError(const uint64_t* count,
+                                     const uint64_t* sum,
+                                     const uint64_t* squares, size_t i,
+                                     size_t j, uint16_t* level)
+{
+    assert(i < j);
+
+    const uint64_t c = count[j] - count[i];
+    const uint64_t s = sum[j] - sum[i];
+    const uint64_t q = squares[j] - squares[i];
+
+    if(c == 0){
+        if(level){
+            *level = (uint16_t)i;
+        }
+        return 0;
+    }
+
+    /*
+     * The error q - 2vs + v^2c is minimal for the integer v the closest to
+     * the mean s/c; v+1 is kept over v only if strictly better. Unsigned
+     * arithmetic wraps around, but the final result is exact.
+     */
+    uint64_t v = s/c;
+    if(2*s > c*(2*v + 1)){
+        v++;
+    }
+    if(level){
+        *level = (uint16_t)v;
+    }
+    return (int64_t)(q - 2*v*s + v*v*c);
+}
+
+/***********************************************************************
+ * Absolute error made by replacing the gray levels of a sub-histogram
+ * by a given level, in O(1) thanks to the prefix moments.
+ *
+ * PARAMETERS
+ * count, sum         The prefix moments of the histogram
+ * i                  The beginning of the sub-histogram
+ * median             The replacement level (i <= median < j)
+ * j                  The end (excluded) of the sub-histogram (i < j)
+ *
+ * RETURN
+ * error              \sum_{i <= l < j} h[l]|l - median|
+ ***********************************************************************/
+static inline int64_t absoluteError(const uint64_t* count,
+                                    const uint64_t* sum, size_t i,
+                                    size_t median, size_t j)
+{
+    //Levels below the median, then levels above it (wrapping is harmless)
+    return (int64_t)(median*(count[median] - count[i]) -
+                     (sum[median] - sum[i]) +
+                     (sum[j] - sum[median]) -
+                     median*(count[j] - count[median]));
+}
+
+/***********************************************************************
+ * Same as defineMinError for the absolute error, the best level being
+ * the (lower) median of the sub-histogram, found by a binary search on
+ * the prefix counts.
+ ***********************************************************************/
+static inline int64_t defineMinAbsoluteError(const uint64_t* count,
+                                             const uint64_t* sum,
+                                             const uint64_t* squares,
+                                             size_t i, size_t j,
+                                             uint16_t* level)
+{
+    assert(i < j);
+    (void)squares;
+
+    //Smallest median such that [i, median] holds half of the pixels
+    const uint64_t c = count[j] - count[i];
+    size_t lower = i, upper = j - 1;
+    while(lower < upper){
+        size_t middle = lower + (upper - lower)/2;
+        if(2*(count[middle+1] - count[i]) >= c){
+            upper = middle;
+        }else{
+            lower = middle + 1;
+        }
+    }
+    if(level){
+        *level = (uint16_t)lower;
+    }
+    return absoluteError(count, sum, i, lower, j);
+}
+
+/***********************************************************************
+ * Same as defineMinError for a given error metric.
+ ***********************************************************************/
+static inline int64_t defineIntervalError(ErrorMetric metric,
+                                          const uint64_t* count,
+                                          const uint64_t* sum,
+                                          const uint64_t* squares,
+                                          size_t i, size_t j,
+                                          uint16_t* level)
+{
+    if(metric == ABSOLUTE_ERROR){
+        return defineMinAbsoluteError(count, sum, squares, i, j, level);
+    }
+    return defineMinError(count, sum, squares, i, j, level);
+}
+
+#endif // !_REDUCTION_MOMENTS_H_
@@ -0,0 +1,14 @@
+/***********************************************************************
+ * ReductionSettings
+ * Implementation of the interface ReductionSettings.h
+ ***********************************************************************/
+
+#include "ReductionSettings.h"
+
+static const ReductionSettings defaultSettings = {0, 0, 0.0, SQUARED_ERROR,
+                                                  NULL, 0};
+
+const ReductionSettings* getDefaultReductionSettings(void)
+{
+  return &defaultSettings;
+}
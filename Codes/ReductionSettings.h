@@ -0,0 +1,67 @@
+/***********************************************************************
+ * ReductionSettings
+ * Tuning parameters of a reduction, and report of a reduction.
+ *
+ * Both are passed explicitly to each reduction, so that reductions with
+ * different parameters may run concurrently. A reduction ignores the
+ * parameters it does not use.
+ ***********************************************************************/
+
+#ifndef _REDUCTION_SETTINGS_H_
+#define _REDUCTION_SETTINGS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Types */
+
+/* Error made by replacing a gray level i by g(i) */
+typedef enum
+{
+  SQUARED_ERROR,                // (i - g(i))^2
+  ABSOLUTE_ERROR                // |i - g(i)|
+} ErrorMetric;
+
+/* Tuning parameters of the reductions */
+typedef struct
+{
+  size_t mergeFactor;           // Bins merged by the coarse pass of the DP
+                                // (<= 1: exact DP)
+  size_t refineWindow;          // Half-width, in bins, of the windows where
+                                // the coarse thresholds are refined
+                                // (0: mergeFactor)
+  double samplingRate;          // Fraction of the pixels building the
+                                // histogram (0 or >= 1: all the pixels,
+                                // < 0: chosen from the number of levels)
+  ErrorMetric metric;           // Error minimized by the reduction
+  const size_t* weights;        // Weight w[i] of the error of each gray
+                                // level i (NULL: all 1), the reduction
+                                // minimizing \sum_i w[i]h[i]d(i, g(i))
+  size_t weightsLength;         // Size of weights, the other levels
+                                // weighing 1
+} ReductionSettings;
+
+/* Report of a reduction */
+typedef struct
+{
+  bool approximate;             // Whether errorBound bounds the gap to the
+                                // optimal error (false if the reduction
+                                // cannot bound it)
+  uint64_t error;               // Error of the reduction on the histogram
+                                // (0 if not computed)
+  uint64_t errorBound;          // Upper bound on error - optimal error
+} ReductionReport;
+
+/* Functions */
+
+/***********************************************************************
+ * Get the default tuning parameters (all 0, that is the exact
+ * reduction of the unweighted squared error on all the pixels).
+ *
+ * RETURN
+ * settings     - A pointer to the default parameters
+ ***********************************************************************/
+const ReductionSettings* getDefaultReductionSettings(void);
+
+#endif // !_REDUCTION_SETTINGS_H_
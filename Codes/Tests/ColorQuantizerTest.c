@@ -0,0 +1,137 @@
+/* ========================================================================== *
+ * ColorQuantizerTest                                                         *
+ * Regression tests of the palette reduction of ColorQuantizer.c              *
+ *                                                                            *
+ * gcc Tests/ColorQuantizerTest.c ColorQuantizer.c PortablePixMap.c           *
+ *     PortableGrayMap.c -I. -pthread -lz -o colorTest && ./colorTest         *
+ * ========================================================================== */
+
+/* ========================================================================== *
+ *                                  HEADER                                    *
+ * ========================================================================== */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "ColorQuantizer.h"
+
+/* ========================================================================== *
+ *                                 PROTOTYPES                                 *
+ * ========================================================================== */
+
+/* -------------------------------------------------------------------------- *
+ * Tell whether a quantized image holds a given colour                        *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * image            The image to search                                       *
+ * gray             The value of the three channels of the colour             *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If some pixel has this colour                             *
+ * false            Else                                                      *
+ * -------------------------------------------------------------------------- */
+static bool holdsGray(const PortablePixMap* image, uint16_t gray);
+
+/* -------------------------------------------------------------------------- *
+ * Check that a box holding a single cell does not stop the splits, so that   *
+ * two small clusters far from a dense one keep colours of their own          *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If the test passed                                        *
+ * false            Else                                                      *
+ * -------------------------------------------------------------------------- */
+static bool testUnsplittableBox(void);
+
+/* -------------------------------------------------------------------------- *
+ * Check that a palette far larger than the histogram is clamped to its       *
+ * cells, the colours lying in distinct cells being then kept exactly         *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If the test passed                                        *
+ * false            Else                                                      *
+ * -------------------------------------------------------------------------- */
+static bool testHugePalette(void);
+
+/* ========================================================================== *
+ *                                  FUNCTIONS                                 *
+ * ========================================================================== */
+
+static bool holdsGray(const PortablePixMap* image, uint16_t gray){
+    for(size_t i = 0; i < image->height; i++){
+        for(size_t j = 0; j < image->width; j++){
+            const uint16_t* pixel = &image->array[i][3*j];
+            if(pixel[0] == gray && pixel[1] == gray && pixel[2] == gray){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool testUnsplittableBox(void){
+    //10 pixels at 100, 10 at 150 and the others in the cell [0, 7]^3
+    PortablePixMap* image = createEmptyPixMap(64, 48, 255);
+    if(!image){
+        return false;
+    }
+    srand(1);
+    for(size_t i = 0; i < image->height; i++){
+        for(size_t j = 0; j < image->width; j++){
+            const size_t n = i*image->width + j;
+            for(size_t c = 0; c < 3; c++){
+                image->array[i][3*j + c] = n < 10 ? 100 :
+                                           n < 20 ? 150 : (uint16_t)(rand()%8);
+            }
+        }
+    }
+
+    PortablePixMap* res = quantizeColorImage(image, 3);
+    const bool passed = res && holdsGray(res, 100) && holdsGray(res, 150);
+    deletePixMap(res);
+    deletePixMap(image);
+    return passed;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool testHugePalette(void){
+    //One gray level per column, every 8 levels falling in a cell of its own
+    PortablePixMap* image = createEmptyPixMap(32, 4, 255);
+    if(!image){
+        return false;
+    }
+    for(size_t i = 0; i < image->height; i++){
+        for(size_t j = 0; j < image->width; j++){
+            for(size_t c = 0; c < 3; c++){
+                image->array[i][3*j + c] = (uint16_t)(8*j);
+            }
+        }
+    }
+
+    PortablePixMap* res = quantizeColorImage(image, SIZE_MAX);
+    bool passed = res != NULL;
+    for(size_t j = 0; passed && j < image->width; j++){
+        passed = holdsGray(res, (uint16_t)(8*j));
+    }
+    deletePixMap(res);
+    deletePixMap(image);
+    return passed;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(void){
+    size_t nFailed = 0;
+    if(!testUnsplittableBox()){
+        fprintf(stderr, "testUnsplittableBox failed\n");
+        nFailed++;
+    }
+    if(!testHugePalette()){
+        fprintf(stderr, "testHugePalette failed\n");
+        nFailed++;
+    }
+    printf("%zu test(s) failed\n", nFailed);
+    return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,476 @@
+/* ========================================================================== *
+ * ReductionTest                                                              *
+ * Regression tests of the exact reductions of DPReduction.c and              *
+ * LagrangianReduction.c, against each other and against a brute force        *
+ *                                                                            *
+ * gcc -O2 Tests/ReductionTest.c ReductionSettings.c ReductionMoments.c -I.   *
+ *     -pthread -o reductionTest && ./reductionTest                           *
+ * Adding -mavx2 evaluates the cells of the DP on vector lanes, as long as    *
+ * the moments allow it.                                                      *
+ * ========================================================================== */
+
+/* ========================================================================== *
+ *                                  HEADER                                    *
+ * ========================================================================== */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ReductionSettings.h"
+#include "ReductionMoments.h"
+
+/*
+ * Both reducers define computeReduction and computeReductionWithSettings, as
+ * the reducer is chosen at link time; they are renamed here so that a single
+ * program holds both of them.
+ */
+bool computeLagrangianReduction(const size_t* histogram,
+                                size_t histogramLength, size_t nLevels,
+                                size_t* thresholds, uint16_t* levels);
+bool computeLagrangianReductionWithSettings(const size_t* histogram,
+                                            size_t histogramLength,
+                                            size_t nLevels,
+                                            size_t* thresholds,
+                                            uint16_t* levels,
+                                            const ReductionSettings* settings,
+                                            ReductionReport* report);
+
+#define computeReduction computeDPReduction
+#define computeReductionWithSettings computeDPReductionWithSettings
+#include "DPReduction.c"
+#undef computeReduction
+#undef computeReductionWithSettings
+
+#define computeReduction computeLagrangianReduction
+#define computeReductionWithSettings computeLagrangianReductionWithSettings
+#include "LagrangianReduction.c"
+#undef computeReduction
+#undef computeReductionWithSettings
+
+// Largest histogram reduced by brute force
+#define BRUTE_FORCE_LENGTH 9
+
+/* ========================================================================== *
+ *                                   TYPES                                    *
+ * ========================================================================== */
+
+/* Entry point of a reduction */
+typedef bool (*Reducer)(const size_t* histogram, size_t histogramLength,
+                        size_t nLevels, size_t* thresholds, uint16_t* levels,
+                        const ReductionSettings* settings,
+                        ReductionReport* report);
+
+/* ========================================================================== *
+ *                                 PROTOTYPES                                 *
+ * ========================================================================== */
+
+/* -------------------------------------------------------------------------- *
+ * Error made by replacing the pixels of a gray level by another level        *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * histogram        The histogram                                             *
+ * settings         The metric and the weights of the error                   *
+ * l                The gray level                                            *
+ * v                The level replacing it                                    *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * error            w[l]h[l]d(l, v)                                           *
+ * -------------------------------------------------------------------------- */
+static uint64_t pixelsError(const size_t* histogram,
+                            const ReductionSettings* settings, size_t l,
+                            size_t v);
+
+/* -------------------------------------------------------------------------- *
+ * Optimal error of a reduction, by trying every partition of the histogram   *
+ * in at most k intervals and every level of each interval                    *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * histogram        The histogram                                             *
+ * length           The length of the histogram (<= BRUTE_FORCE_LENGTH)       *
+ * nLevels          The number of levels (k)                                  *
+ * settings         The metric and the weights of the error                   *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * error            The optimal error                                         *
+ * -------------------------------------------------------------------------- */
+static uint64_t bruteForceError(const size_t* histogram, size_t length,
+                                size_t nLevels,
+                                const ReductionSettings* settings);
+
+/* -------------------------------------------------------------------------- *
+ * Run a reduction, and check that its thresholds and levels are well formed  *
+ * and that its reported error is the error of its mapping function           *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * reducer          The reduction to run                                      *
+ * histogram        The histogram                                             *
+ * length           The length of the histogram                               *
+ * nLevels          The number of levels (k)                                  *
+ * settings         The tuning parameters of the reduction (NULL: defaults)   *
+ * report           A valid pointer where the report is stored                *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If the reduction went fine and is consistent              *
+ * false            Else                                                      *
+ * -------------------------------------------------------------------------- */
+static bool runReduction(Reducer reducer, const size_t* histogram,
+                         size_t length, size_t nLevels,
+                         const ReductionSettings* settings,
+                         ReductionReport* report);
+
+/* -------------------------------------------------------------------------- *
+ * Check that both reductions reach the brute-force error                     *
+ *                                                                            *
+ * PARAMETERS                                                                 *
+ * histogram        The histogram                                             *
+ * length           The length of the histogram (<= BRUTE_FORCE_LENGTH)       *
+ * nLevels          The number of levels (k)                                  *
+ * settings         The tuning parameters of the reductions                   *
+ *                                                                            *
+ * RETURNS                                                                    *
+ * true             If both errors are optimal                                *
+ * false            Else                                                      *
+ * -------------------------------------------------------------------------- */
+static bool matchesBruteForce(const size_t* histogram, size_t length,
+                              size_t nLevels,
+                              const ReductionSettings* settings);
+
+/* -------------------------------------------------------------------------- *
+ * The tests. Each one returns true if it passed.                             *
+ *                                                                            *
+ * testSmallHistograms  Random histograms, both metrics, with and without     *
+ *                      weights, against the brute force                      *
+ * testTies             Histograms with several optimal levels or partitions  *
+ * testIdentity         At least as many levels as occupied bins              *
+ * testMomentLimit      Weights just below MOMENT_LIMIT, which take the DP    *
+ *                      off the vector lanes, and just above it               *
+ * testLargeHistograms  Histograms of more than SMALL_HISTOGRAM_LENGTH bins,  *
+ *                      the DP against the Lagrangian reduction               *
+ * testCoarseToFine     The error and the bound reported by coarse-to-fine    *
+ * -------------------------------------------------------------------------- */
+static bool testSmallHistograms(void);
+static bool testTies(void);
+static bool testIdentity(void);
+static bool testMomentLimit(void);
+static bool testLargeHistograms(void);
+static bool testCoarseToFine(void);
+
+/* ========================================================================== *
+ *                                  FUNCTIONS                                 *
+ * ========================================================================== */
+
+static uint64_t pixelsError(const size_t* histogram,
+                            const ReductionSettings* settings, size_t l,
+                            size_t v){
+    const uint64_t d = l > v ? l - v : v - l;
+    uint64_t error = histogram[l]*(settings->metric == ABSOLUTE_ERROR ? d
+                                                                     : d*d);
+    if(settings->weights && l < settings->weightsLength){
+        error *= settings->weights[l];
+    }
+    return error;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint64_t bruteForceError(const size_t* histogram, size_t length,
+                                size_t nLevels,
+                                const ReductionSettings* settings){
+    //Each bit of a mask tells whether an interval ends after a bin
+    uint64_t best = UINT64_MAX;
+    for(size_t mask = 0; mask < ((size_t)1 << (length - 1)); mask++){
+        size_t nIntervals = 1, begin = 0;
+        uint64_t error = 0;
+        for(size_t end = 1; end <= length; end++){
+            if(end < length && !(mask >> (end - 1) & 1)){
+                continue;
+            }
+            uint64_t intervalBest = UINT64_MAX;
+            for(size_t v = begin; v < end; v++){
+                uint64_t intervalError = 0;
+                for(size_t l = begin; l < end; l++){
+                    intervalError += pixelsError(histogram, settings, l, v);
+                }
+                if(intervalError < intervalBest){
+                    intervalBest = intervalError;
+                }
+            }
+            error += intervalBest;
+            nIntervals += end < length;
+            begin = end;
+        }
+        if(nIntervals <= nLevels && error < best){
+            best = error;
+        }
+    }
+    return best;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool runReduction(Reducer reducer, const size_t* histogram,
+                         size_t length, size_t nLevels,
+                         const ReductionSettings* settings,
+                         ReductionReport* report){
+    if(!settings){
+        settings = getDefaultReductionSettings();
+    }
+    size_t* thresholds = malloc(nLevels*sizeof(size_t));
+    uint16_t* levels = malloc(nLevels*sizeof(uint16_t));
+    bool passed = thresholds && levels &&
+                  reducer(histogram, length, nLevels, thresholds, levels,
+                          settings, report);
+
+    //Sorted thresholds ending with the histogram, levels inside it
+    for(size_t k = 0; passed && k < nLevels; k++){
+        passed = levels[k] < length &&
+                 (k == 0 || thresholds[k-1] <= thresholds[k]);
+    }
+    passed = passed && thresholds[nLevels-1] == length;
+
+    //Error of the mapping function g
+    uint64_t error = 0;
+    for(size_t l = 0, k = 0; passed && l < length; l++){
+        while(thresholds[k] <= l){
+            k++;
+        }
+        error += pixelsError(histogram, settings, l, levels[k]);
+    }
+    passed = passed && error == report->error;
+
+    free(thresholds);
+    free(levels);
+    return passed;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool matchesBruteForce(const size_t* histogram, size_t length,
+                              size_t nLevels,
+                              const ReductionSettings* settings){
+    const uint64_t expected = bruteForceError(histogram, length, nLevels,
+                                              settings);
+    ReductionReport dp, lagrangian;
+    return runReduction(computeDPReductionWithSettings, histogram, length,
+                        nLevels, settings, &dp) &&
+           runReduction(computeLagrangianReductionWithSettings, histogram,
+                        length, nLevels, settings, &lagrangian) &&
+           dp.error == expected && lagrangian.error == expected;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool testSmallHistograms(void){
+    srand(1);
+    size_t histogram[BRUTE_FORCE_LENGTH], weights[BRUTE_FORCE_LENGTH];
+    for(size_t t = 0; t < 3000; t++){
+        //Many empty bins, and weights of 0 at times
+        const size_t length = 1 + (size_t)rand()%BRUTE_FORCE_LENGTH;
+        for(size_t l = 0; l < length; l++){
+            histogram[l] = rand()%3 == 0 ? 0 : (size_t)(rand()%20);
+            weights[l] = (size_t)(rand()%5);
+        }
+        ReductionSettings settings = *getDefaultReductionSettings();
+        settings.metric = t%2 ? ABSOLUTE_ERROR : SQUARED_ERROR;
+        if(t%4 >= 2){
+            settings.weights = weights;
+            settings.weightsLength = (size_t)rand()%(length + 1);
+        }
+
+        const size_t nLevels = 1 + (size_t)rand()%(length + 2);
+        if(!matchesBruteForce(histogram, length, nLevels, &settings)){
+            fprintf(stderr, "  case %zu: length %zu, %zu levels\n", t,
+                    length, nLevels);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool testTies(void){
+    //Means halfway between two levels, and even counts for the median
+    const size_t halves[] = {1, 1};
+    const size_t ends[] = {2, 0, 0, 2};
+    const size_t flat[] = {3, 3, 3, 3, 3, 3, 3, 3};
+    const size_t mirror[] = {5, 1, 0, 0, 1, 5};
+    ReductionSettings settings = *getDefaultReductionSettings();
+    bool passed = true;
+    for(size_t m = 0; m < 2; m++){
+        settings.metric = m ? ABSOLUTE_ERROR : SQUARED_ERROR;
+        for(size_t k = 1; k <= 3; k++){
+            passed &= matchesBruteForce(halves, 2, k, &settings);
+            passed &= matchesBruteForce(ends, 4, k, &settings);
+            passed &= matchesBruteForce(flat, 8, k, &settings);
+            passed &= matchesBruteForce(mirror, 6, k, &settings);
+        }
+    }
+    return passed;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool testIdentity(void){
+    //100 occupied bins of a 16-bit histogram
+    const size_t length = 65536;
+    size_t* histogram = calloc(length, sizeof(size_t));
+    if(!histogram){
+        return false;
+    }
+    for(size_t b = 0; b < 100; b++){
+        histogram[(b*2654435761u) % length] += 1 + b;
+    }
+
+    const size_t nLevels[] = {100, 101, 4096, 65536};
+    const Reducer reducers[] = {computeDPReductionWithSettings,
+                                computeLagrangianReductionWithSettings};
+    bool passed = true;
+    for(size_t k = 0; k < sizeof(nLevels)/sizeof(nLevels[0]); k++){
+        for(size_t r = 0; r < 2; r++){
+            ReductionReport report;
+            passed &= runReduction(reducers[r], histogram, length,
+                                   nLevels[k], NULL, &report) &&
+                      report.error == 0;
+        }
+    }
+    free(histogram);
+    return passed;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool testMomentLimit(void){
+    //The heavy levels bring the squares just below MOMENT_LIMIT
+    const size_t histogram[] = {1, 0, 3, 0, 1, 1};
+    size_t weights[] = {1, 1, 1, 1, 0, 0};
+    const size_t heavy = (size_t)(MOMENT_LIMIT/(16 + 25)) - 1;
+    weights[4] = weights[5] = heavy;
+
+    ReductionSettings settings = *getDefaultReductionSettings();
+    settings.weights = weights;
+    settings.weightsLength = 6;
+    bool passed = true;
+    for(size_t m = 0; m < 2; m++){
+        settings.metric = m ? ABSOLUTE_ERROR : SQUARED_ERROR;
+        for(size_t k = 1; k <= 4; k++){
+            passed &= matchesBruteForce(histogram, 6, k, &settings);
+        }
+    }
+
+    //Twice as heavy, the moments no longer fit
+    weights[4] = weights[5] = 2*heavy;
+    size_t thresholds[2];
+    uint16_t levels[2];
+    passed &= !computeDPReductionWithSettings(histogram, 6, 2, thresholds,
+                                              levels, &settings, NULL);
+    passed &= !computeLagrangianReductionWithSettings(histogram, 6, 2,
+                                                      thresholds, levels,
+                                                      &settings, NULL);
+    return passed;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool testLargeHistograms(void){
+    srand(2);
+    const size_t maxLength = 700;
+    size_t* histogram = malloc(maxLength*sizeof(size_t));
+    size_t* weights = malloc(maxLength*sizeof(size_t));
+    bool passed = histogram && weights;
+    for(size_t t = 0; passed && t < 40; t++){
+        const size_t length = SMALL_HISTOGRAM_LENGTH + 1 +
+                              (size_t)rand()%(maxLength -
+                                              SMALL_HISTOGRAM_LENGTH);
+        for(size_t l = 0; l < length; l++){
+            histogram[l] = rand()%4 == 0 ? 0 : (size_t)(rand()%1000);
+            weights[l] = 1 + (size_t)(rand()%8);
+        }
+        ReductionSettings settings = *getDefaultReductionSettings();
+        settings.metric = t%2 ? ABSOLUTE_ERROR : SQUARED_ERROR;
+        if(t%4 >= 2){
+            settings.weights = weights;
+            settings.weightsLength = length;
+        }
+
+        const size_t nLevels = 1 + (size_t)rand()%12;
+        ReductionReport dp, lagrangian;
+        passed = runReduction(computeDPReductionWithSettings, histogram,
+                              length, nLevels, &settings, &dp) &&
+                 runReduction(computeLagrangianReductionWithSettings,
+                              histogram, length, nLevels, &settings,
+                              &lagrangian) &&
+                 dp.error == lagrangian.error;
+        if(!passed){
+            fprintf(stderr, "  case %zu: length %zu, %zu levels\n", t,
+                    length, nLevels);
+        }
+    }
+    free(histogram);
+    free(weights);
+    return passed;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool testCoarseToFine(void){
+    srand(3);
+    const size_t length = 2048;
+    size_t* histogram = malloc(length*sizeof(size_t));
+    bool passed = histogram != NULL;
+    for(size_t t = 0; passed && t < 10; t++){
+        for(size_t l = 0; l < length; l++){
+            histogram[l] = (size_t)(rand()%100)*(l%64 < 8 ? 50 : 1);
+        }
+        ReductionSettings settings = *getDefaultReductionSettings();
+        settings.mergeFactor = 4 + 4*(t%3);
+        settings.refineWindow = t%2 ? 2 : 0;
+
+        //The optimal error lies between error - errorBound and error
+        const size_t nLevels = 2 + t;
+        ReductionReport coarse, exact;
+        passed = runReduction(computeDPReductionWithSettings, histogram,
+                              length, nLevels, &settings, &coarse) &&
+                 runReduction(computeLagrangianReductionWithSettings,
+                              histogram, length, nLevels, NULL, &exact) &&
+                 coarse.approximate && coarse.errorBound <= coarse.error &&
+                 coarse.error - coarse.errorBound <= exact.error &&
+                 exact.error <= coarse.error;
+        if(!passed){
+            fprintf(stderr, "  case %zu: merge %zu, %zu levels\n", t,
+                    settings.mergeFactor, nLevels);
+        }
+    }
+    free(histogram);
+    return passed;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(void){
+#ifdef VECTORISED_DP
+    printf("DP cells evaluated on vector lanes\n");
+#endif
+    struct {
+        const char* name;
+        bool (*run)(void);
+    } tests[] = {
+        {"testSmallHistograms", testSmallHistograms},
+        {"testTies", testTies},
+        {"testIdentity", testIdentity},
+        {"testMomentLimit", testMomentLimit},
+        {"testLargeHistograms", testLargeHistograms},
+        {"testCoarseToFine", testCoarseToFine}
+    };
+
+    size_t nFailed = 0;
+    for(size_t t = 0; t < sizeof(tests)/sizeof(tests[0]); t++){
+        if(!tests[t].run()){
+            fprintf(stderr, "%s failed\n", tests[t].name);
+            nFailed++;
+        }
+    }
+    printf("%zu test(s) failed\n", nFailed);
+    return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -5,93 +5,314 @@
  * NOM
  *      quantizer
  * SYNOPSIS
- *      quantizer inputImg k outputName
+ *      quantizer [-d depth] [-m MiB] [-c factor [-w window]] [-s rate]
+ *                [-e metric] [-W weights] [-l format | -p] inputImg k
+ *                outputName [inputImg outputName]...
  * DESCIRPTION
- *      Quantizes the input image on k levels and save it.
+ *      Quantizes the input image(s) on k levels and save it (them).
+ *      Colour images (PPM) are quantized on a palette of k colours.
+ *      Floating-point images (PFM, "Pf") are quantized on k real levels,
+ *      fitted to their samples on a histogram of fine bins.
+ *      Several images are loaded, quantized and saved in a pipeline, so
+ *      that the I/O of an image overlaps the computations of another one.
+ *      An input holding several images back to back gives an output
+ *      holding their quantized versions in the same order. The name "-"
+ *      stands for the standard input (PGM only) or output.
+ * OPTIONS
+ *      -d depth    Number of images waiting between two stages (default 2)
+ *      -m MiB      Soft limit on the memory used by the rasters in flight
+ *      -c factor   Run the DP on bins merged by this factor, then refine the
+ *                  thresholds at full resolution (large histograms only)
+ *      -w window   Half-width of the refinement windows (default: factor)
+ *      -s rate     Build the histogram on this fraction of the pixels, or on
+ *                  a number of pixels fitting the number of levels if rate
+ *                  is "auto" (the error is still computed on all pixels)
+ *      -e metric   Error minimized by the reduction: "l2" (squared error,
+ *                  default) or "l1" (absolute error)
+ *      -W weights  File of the weights of the error of each gray level, in
+ *                  the text format of the histograms (missing ones are 1)
+ *      -l format   Only compute the mapping of the gray levels and save its
+ *                  thresholds, levels, lookup table and error ("bin" or
+ *                  "json"); the inputs may then be histograms as well as
+ *                  PGM images, described in GrayMapping.h
+ *      -p          Quantize all the gray images of the batch on the same k
+ *                  levels, optimal for their merged histograms
  * USAGE
  *      ./quantizer lena.pgm 4 lena_4.pgm
  *          Will compress the image lena.pgm on 4 levels and save it under
  *          the name "lena_4.pgm".
+ *      ./quantizer lena.pgm 4 lena_4.pgm coins.pgm coins_4.pgm
+ *          Will do the same for lena.pgm and coins.pgm.
+ *      cat lena.pgm coins.pgm | ./quantizer - 4 - | pnmsplit - out%d.pgm
+ *          Will quantize both images through a pipe.
+ *      ./quantizer -l json histogram.txt 4 mapping.json
+ *          Will save the optimal mapping of a histogram on 4 levels.
+ *      ./quantizer -p lena.pgm 4 lena_4.pgm coins.pgm coins_4.pgm
+ *          Will quantize both images on the same 4 levels.
  * ------------------------------------------------------------------------- *
  * ========================================================================= */
 
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "PortableGrayMap.h"
 #include "ImageQuantizer.h"
+#include "GrayMapping.h"
+#include "Pipeline.h"
+#include "ReductionSettings.h"
 
 
+/*
+ * Compute the mapping of an input, a PGM image or a histogram, and save it
+ * without remapping any pixel. Returns 0 if no error.
+ */
+static int exportMapping(const char* inputName, size_t nbLevels,
+                         const char* outputName, GrayMappingFormat format,
+                         const ReductionSettings* reductionSettings)
+{
+    FILE* file = openImageFile(inputName, false);
+    if (!file)
+        return -1;
+
+    // Images start with their magic number, histograms never with a 'P'
+    int first = fgetc(file);
+    if (first != EOF)
+        ungetc(first, file);
+
+    GrayMapping* mapping = NULL;
+    if (first == 'P')
+    {
+        // The rows go to the histogram as they are read, never all held
+        const int kind = readMagicNumber(file);
+        mapping = computeStreamMapping(file, kind, nbLevels,
+                                       reductionSettings);
+    }
+    else
+    {
+        size_t length = 0;
+        size_t* histogram = createHistogramFromStream(file, &length);
+        mapping = computeGrayMapping(histogram, length, nbLevels,
+                                     reductionSettings);
+        free(histogram);
+    }
+    // A corrupted compressed input may only be noticed at its end
+    const int closed = closeImageFile(file);
+    if (!mapping || closed != 0 ||
+        saveMappingToFile(mapping, outputName, format) != 0)
+    {
+        deleteMapping(mapping);
+        return -1;
+    }
+
+    // The standard output may carry the mapping instead of the error
+    fprintf(strcmp(outputName, "-") == 0 ? stderr : stdout,
+            "Compression error: %lu\n", (unsigned long)mapping->error);
+    deleteMapping(mapping);
+    return 0;
+}
+
 
 int main(int argc, char** argv)
 {
+    // Parsing options
+    ReductionSettings reductionSettings = *getDefaultReductionSettings();
+    PipelineSettings settings = {0, 0, false, &reductionSettings};
+    size_t memoryMiB = 0;
+    const char* weightsName = NULL;
+    int mappingOnly = 0;
+    GrayMappingFormat mappingFormat = MAPPING_BINARY;
+    int option;
+    while ((option = getopt(argc, argv, "d:m:c:w:s:e:W:l:p")) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            if (sscanf(optarg, "%zu", &settings.queueDepth) != 1 ||
+                settings.queueDepth == 0)
+            {
+                fprintf(stderr, "Aborting; queue depth should be a positive "
+                                "int. Got '%s'.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'm':
+            if (sscanf(optarg, "%zu", &memoryMiB) != 1)
+            {
+                fprintf(stderr, "Aborting; memory limit should be unsigned "
+                                "int. Got '%s'.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            settings.memoryLimit = memoryMiB << 20;
+            break;
+        case 'c':
+            if (sscanf(optarg, "%zu", &reductionSettings.mergeFactor) != 1)
+            {
+                fprintf(stderr, "Aborting; merge factor should be unsigned "
+                                "int. Got '%s'.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'w':
+            if (sscanf(optarg, "%zu", &reductionSettings.refineWindow) != 1)
+            {
+                fprintf(stderr, "Aborting; refine window should be unsigned "
+                                "int. Got '%s'.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            if (strcmp(optarg, "auto") == 0)
+                reductionSettings.samplingRate = -1.0;
+            else if (sscanf(optarg, "%lf", &reductionSettings.samplingRate)
+                     != 1 || reductionSettings.samplingRate <= 0.0)
+            {
+                fprintf(stderr, "Aborting; sampling rate should be a positive "
+                                "real or 'auto'. Got '%s'.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'e':
+            if (strcmp(optarg, "l2") == 0)
+                reductionSettings.metric = SQUARED_ERROR;
+            else if (strcmp(optarg, "l1") == 0)
+                reductionSettings.metric = ABSOLUTE_ERROR;
+            else
+            {
+                fprintf(stderr, "Aborting; error metric should be 'l2' or "
+                                "'l1'. Got '%s'.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'W':
+            weightsName = optarg;
+            break;
+        case 'l':
+            mappingOnly = 1;
+            if (strcmp(optarg, "bin") == 0)
+                mappingFormat = MAPPING_BINARY;
+            else if (strcmp(optarg, "json") == 0)
+                mappingFormat = MAPPING_JSON;
+            else
+            {
+                fprintf(stderr, "Aborting; mapping format should be 'bin' or "
+                                "'json'. Got '%s'.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            settings.sharedLevels = true;
+            break;
+        default:
+            return EXIT_FAILURE;
+        }
+    }
+
     // Checking arguments
-    if (argc != 4)
+    int nArgs = argc - optind;
+    if (nArgs < 3 || nArgs % 2 == 0)
     {
         /*
-         * argv[0]: name of the executable
-         * argv[1]: name of the input file
-         * argv[2]: number of levels
-         * argv[3]: name of the output file
+         * argv[optind]:     name of the first input file
+         * argv[optind + 1]: number of levels
+         * argv[optind + 2]: name of the first output file
+         * then, optionally, pairs of input and output file names
          */
-        fprintf(stderr, "Usage: %s <PGM input image> <unsgined int> "
-                        "<PGM output name>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-d depth] [-m MiB] [-c factor "
+                        "[-w window]] [-s rate] [-e metric] [-W weights] "
+                        "[-l format | -p] <PGM input image> "
+                        "<unsgined int> <PGM output name> "
+                        "[<PGM input image> <PGM output name>]...\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (mappingOnly && settings.sharedLevels)
+    {
+        fprintf(stderr, "Aborting; -l and -p cannot be combined.\n");
         return EXIT_FAILURE;
     }
+    char** args = argv + optind;
 
     // Parsing arguments
     size_t nbLevels = 0;
-    if(sscanf(argv[2], "%zu", &nbLevels) != 1)
+    if(sscanf(args[1], "%zu", &nbLevels) != 1)
     {
         fprintf(stderr, "Aborting; number of levels should be unsigned int. "
-                        "Got '%s'.\n", argv[2]);
+                        "Got '%s'.\n", args[1]);
         return EXIT_FAILURE;
     }
 
-    // Loading input Image
-    PortableGrayMap* inputImg = createImageFromFile(argv[1]);
-    if(!inputImg)
+    // Gathering the (input, output) pairs
+    size_t nImages = (size_t)(nArgs - 1) / 2;
+    const char** names = malloc(2 * nImages * sizeof(char*));
+    if (!names)
     {
-        fprintf(stderr, "Aborting; error while loading input image '%s'\n",
-                argv[1]);
+        fprintf(stderr, "Aborting; out of memory\n");
         return EXIT_FAILURE;
     }
-
-    // Quantizing
-    PortableGrayMap* outputImg = quantizeGrayImage(inputImg, nbLevels);
-    if(!outputImg)
+    const char** inputNames = names;
+    const char** outputNames = names + nImages;
+    inputNames[0] = args[0];
+    outputNames[0] = args[2];
+    for (size_t i = 1; i < nImages; i++)
     {
-        fprintf(stderr, "Aborting; error while computing the reduction\n");
-        deleteImage(inputImg);
-        return EXIT_FAILURE;
+        inputNames[i] = args[2 * i + 1];
+        outputNames[i] = args[2 * i + 2];
     }
 
-    // Computing the error
-    unsigned long error = 0;
-    long errComp = 0;
-    for (size_t i = 0; i < inputImg->height; i++)
+    // Loading the weights of the gray levels
+    size_t* weights = NULL;
+    if (weightsName)
     {
-        for(size_t j = 0; j < inputImg->width; j++)
+        FILE* file = openImageFile(weightsName, false);
+        if (file)
         {
-            errComp = (long)(inputImg->array[i][j]) - \
-                      (long)(outputImg->array[i][j]);
-            error += (unsigned long)(errComp*errComp);
+            size_t* length = &reductionSettings.weightsLength;
+            weights = createHistogramFromStream(file, length);
+
+            // A corrupted compressed file may only be noticed at its end
+            if (closeImageFile(file) != 0)
+            {
+                free(weights);
+                weights = NULL;
+            }
         }
+        if (!weights)
+        {
+            fprintf(stderr, "Aborting; cannot read the weights in '%s'.\n",
+                    weightsName);
+            free(names);
+            return EXIT_FAILURE;
+        }
+        reductionSettings.weights = weights;
     }
-    fprintf(stdout, "Compression error: %lu\n", error);
 
-
-    // Saving output image
-    if(saveImageToFile(outputImg, argv[3]) != 0)
+    // Loading, quantizing and saving, or only computing the mappings
+    size_t nFailed = 0;
+    if (mappingOnly)
+    {
+        for (size_t i = 0; i < nImages; i++)
+        {
+            if (exportMapping(inputNames[i], nbLevels, outputNames[i],
+                              mappingFormat, &reductionSettings) != 0)
+            {
+                fprintf(stderr, "Skipping '%s'; error while computing the "
+                                "mapping\n", inputNames[i]);
+                nFailed++;
+            }
+        }
+    }
+    else
+        nFailed = runQuantizationPipeline(inputNames, outputNames, nImages,
+                                          nbLevels, &settings);
+    free(names);
+    free(weights);
+    if (nFailed > 0)
     {
-        fprintf(stderr, "Aborting; error while saving output image in '%s'\n",
-                argv[3]);
-        deleteImage(inputImg);
-        deleteImage(outputImg);
+        fprintf(stderr, "Aborting; %zu image(s) failed\n", nFailed);
         return EXIT_FAILURE;
     }
 
-    deleteImage(inputImg);
-    deleteImage(outputImg);
     return EXIT_SUCCESS;
 }